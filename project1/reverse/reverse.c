@@ -1,13 +1,24 @@
 //Your code goes here..!
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <errno.h>
+#include <limits.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include "../utilities/common/fastio.h"
+
+#define ARENA_INITIAL (1 << 20)
+/*
+ * Input that cannot be mapped is held in memory up to one segment; beyond
+ * that it is spilled to disk. Override with REVERSE_SEGMENT_SIZE (bytes).
+ */
+#define SEGMENT_SIZE (48 << 20)
+#define COPY_SIZE (1 << 20)
 
 enum _io_type_ {
     IO_RD_STDIN_WR_STDOUT = 1,
@@ -16,103 +27,230 @@ enum _io_type_ {
     IO_ERROR
 };
 
-typedef struct _node_{
-    void *data;
-    uint32_t data_len;
-    struct _node_ *next;
-} node;
-
-typedef struct {
-    node *head;
-    uint32_t count;
-} stack;
+/*
+ * Queue the lines of data[0..len) in reverse order, straight out of the
+ * input buffer. Walks backwards with memrchr; a final line without a
+ * trailing newline is written first, as is. data must stay valid until
+ * the writer is flushed.
+ */
+static void write_reversed(const char *data, size_t len, io_writer *out) {
+    size_t end = len;
 
+    while (end > 0) {
+        /* Skip the newline that terminates the current line */
+        const char *nl = memrchr(data, '\n', end - 1);
+        size_t start = nl ? (size_t) (nl + 1 - data) : 0;
 
-static stack *create_stack(void) {
-    stack *new_stack = (stack *) malloc(sizeof(stack));
-    if (new_stack != NULL) {
-        new_stack->head = NULL;
-        new_stack->count = 0;
+        io_write_ref(out, data + start, end - start);
+        end = start;
     }
-    return new_stack;
 }
 
-static uint8_t push(stack *user_stack, char *data, uint32_t data_len) {
-    node *new_node = (node *) malloc(sizeof(node));
-    if (new_node != NULL) {
-        new_node->data = (void *) data;
-        new_node->data_len = data_len;
-        new_node->next = user_stack->head;
-        user_stack->head = new_node;
-        user_stack->count++;
-        return 1;
-    }
+/* Read until buf[0..cap) is full or EOF. Returns the bytes read, or -1 */
+static ssize_t read_full(int fd, char *buf, size_t cap) {
+    size_t fill = 0;
 
-    return 0;
+    while (fill < cap) {
+        ssize_t nread = read(fd, buf + fill, cap - fill);
+        if (nread < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (nread == 0) {
+            break;
+        }
+        fill += nread;
+    }
+    return fill;
 }
 
-static node *pop(stack *user_stack) {
-    if (user_stack == NULL) {
-        return NULL;
-    }
+/*
+ * Read fd into one growing arena of at most max bytes. Used for stdin and
+ * anything else that cannot be mapped. Returns 0 at end of input, 1 if the
+ * arena filled up first, -1 on error. Must free *data once finished.
+ */
+static int read_arena(int fd, size_t max, char **data, size_t *len) {
+    size_t cap = ARENA_INITIAL < max ? ARENA_INITIAL : max;
+    size_t fill = 0;
+    char *arena = malloc(cap);
 
-    node *popped_node = user_stack->head;
-    if (popped_node != NULL) {
-        user_stack->head = popped_node->next;
-        user_stack->count--;
+    while (arena != NULL) {
+        if (fill == cap) {
+            if (cap == max) {
+                *data = arena;
+                *len = fill;
+                return 1;
+            }
+            size_t new_cap = 2 * cap < max ? 2 * cap : max;
+            char *grown = realloc(arena, new_cap);
+            if (grown == NULL) {
+                break;
+            }
+            arena = grown;
+            cap = new_cap;
+        }
+
+        ssize_t nread = read(fd, arena + fill, cap - fill);
+        if (nread < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            free(arena);
+            fprintf(stderr, "reverse: read failed\n");
+            return -1;
+        }
+        if (nread == 0) {
+            *data = arena;
+            *len = fill;
+            return 0;
+        }
+        fill += nread;
     }
 
-    return popped_node;
+    free(arena);
+    fprintf(stderr, "malloc failed\n");
+    return -1;
 }
 
-/* Must free data once finished */
-static stack *parse_input(FILE *input) {
-    /* Read lines and add them to a linkedlist */
-    size_t nread = 0;
-    size_t len = 0;
-    char *line = NULL;
-    stack *input_stack = create_stack();
-    if (input_stack == NULL) {
-        /* Failed to allocate memory, handle it */
-        fprintf(stderr, "malloc failed\n");
-        return NULL;
+/*
+ * External-memory reversal for input larger than the arena. The input is
+ * spilled to an unlinked temporary file in segments of seg_size bytes, and
+ * then the segments are loaded back one at a time, last to first, and their
+ * lines written out in reverse. A line that crosses into earlier segments
+ * is found by scanning back segment by segment, then streamed forward from
+ * the spill file through a small copy buffer. Peak memory is one segment
+ * plus COPY_SIZE, however large the input.
+ */
+static int spill_reverse(int in_fd, io_writer *out, char *seg, size_t seg_size) {
+    char tmpl[PATH_MAX];
+    const char *tmpdir = getenv("TMPDIR");
+    char *copy = io_alloc(COPY_SIZE);
+    off_t total = 0;
+    int ret = -1;
+
+    snprintf(tmpl, sizeof(tmpl), "%s/reverse.XXXXXX", tmpdir ? tmpdir : "/tmp");
+    int spill_fd = mkstemp(tmpl);
+    if (spill_fd < 0 || copy == NULL) {
+        fprintf(stderr, "reverse: cannot create temporary file\n");
+        free(copy);
+        return -1;
     }
+    unlink(tmpl);
 
-    while ((nread = getline(&line, &len, input)) != -1) {
-        char *data_buff = (char *) malloc((nread+1)*sizeof(char));
-        data_buff[nread] = 0;	//null terminate the string
-        if (data_buff == NULL) {
-            errno = ENOMEM;
-            break;
+    /* The arena is full; it becomes segment 0 */
+    ssize_t seg_len = seg_size;
+    while (seg_len > 0) {
+        if (io_write_all(spill_fd, seg, seg_len) != 0) {
+            fprintf(stderr, "reverse: cannot write temporary file\n");
+            goto out;
+        }
+        total += seg_len;
+        seg_len = read_full(in_fd, seg, seg_size);
+        if (seg_len < 0) {
+            fprintf(stderr, "reverse: read failed\n");
+            goto out;
+        }
+    }
+
+    off_t pos = total;          /* lines at and after pos are written */
+    off_t seg_start = total;    /* the loaded segment is [seg_start, +seg_len) */
+    seg_len = 0;
+    while (pos > 0) {
+        /* Make sure byte pos - 1 is in the loaded segment */
+        if (pos <= seg_start) {
+            if (io_flush(out) != 0) {
+                goto out;
+            }
+            seg_start = ((pos - 1) / seg_size) * seg_size;
+            seg_len = pread(spill_fd, seg, seg_size, seg_start);
+            if (seg_len <= 0) {
+                fprintf(stderr, "reverse: cannot read temporary file\n");
+                goto out;
+            }
         }
 
-        memcpy(data_buff, line, nread);
+        /* Skip the newline that terminates the current line */
+        const char *nl = memrchr(seg, '\n', pos - 1 - seg_start);
+        if (nl != NULL) {
+            off_t start = seg_start + (nl + 1 - seg);
+            io_write_ref(out, seg + (start - seg_start), pos - start);
+            pos = start;
+            continue;
+        }
 
-        if (push(input_stack, data_buff, nread) == 0) {
-            errno = ENOMEM;
-            break;
+        /* The line starts in an earlier segment; find where */
+        if (io_flush(out) != 0) {
+            goto out;
         }
-    }
-    free(line);
-
-    if (errno == ENOMEM) {
-        /* Malloc failed to allocate. Free up everything, print message
-         * and exit.
-         */
-        node *temp_node;
-        while (input_stack->count > 0) {
-            temp_node = pop(input_stack);
-            free(temp_node->data);
-            free(temp_node);
+        off_t start = 0;
+        while (seg_start > 0) {
+            seg_start -= seg_size;
+            seg_len = pread(spill_fd, seg, seg_size, seg_start);
+            if (seg_len <= 0) {
+                fprintf(stderr, "reverse: cannot read temporary file\n");
+                goto out;
+            }
+            nl = memrchr(seg, '\n', seg_len);
+            if (nl != NULL) {
+                start = seg_start + (nl + 1 - seg);
+                break;
+            }
         }
 
-        free(input_stack);
+        for (off_t off = start; off < pos; ) {
+            size_t want = pos - off < COPY_SIZE ? pos - off : COPY_SIZE;
+            ssize_t nread = pread(spill_fd, copy, want, off);
+            if (nread <= 0) {
+                fprintf(stderr, "reverse: cannot read temporary file\n");
+                goto out;
+            }
+            if (io_write_all(out->fd, copy, nread) != 0) {
+                out->error = 1;
+                goto out;
+            }
+            off += nread;
+        }
+        pos = start;
+    }
+    ret = io_flush(out);
 
-        fprintf(stderr, "malloc failed\n");
-        return NULL;
+out:
+    close(spill_fd);
+    free(copy);
+    return ret;
+}
+
+static int reverse_fd(int in_fd, io_writer *out) {
+    char *data;
+    size_t len;
+    int ret;
+
+    if (io_map(in_fd, &data, &len) == 0) {
+        write_reversed(data, len, out);
+        ret = io_flush(out);
+        io_unmap(data, len);
+        return ret;
+    }
+
+    size_t seg_size = SEGMENT_SIZE;
+    const char *env = getenv("REVERSE_SEGMENT_SIZE");
+    if (env != NULL && atol(env) > 0) {
+        seg_size = atol(env);
+    }
+
+    ret = read_arena(in_fd, seg_size, &data, &len);
+    if (ret == 0) {
+        write_reversed(data, len, out);
+        ret = io_flush(out);
+    } else if (ret == 1) {
+        ret = spill_reverse(in_fd, out, data, len);
     } else {
-        return input_stack;
+        return -1;
     }
+    free(data);
+    return ret;
 }
 
 static uint8_t check_same(char *f1, char*f2) {
@@ -170,16 +308,15 @@ int main(int argc, char *argv[]) {
             break;
     };
 
-    stack *parsed_input = parse_input(in_stream);
-    if (parsed_input != NULL) {
-        while (parsed_input->count > 0) {
-            node *curr_line = pop(parsed_input);
-            fprintf(out_stream, "%s", (char *) curr_line->data);
-            free(curr_line->data);
-            free(curr_line);
-        }
-
-        free(parsed_input);
+    io_writer out;
+    if (io_writer_open(&out, fileno(out_stream)) != 0) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
+    int ret = reverse_fd(fileno(in_stream), &out) != 0;
+    if (io_writer_close(&out) != 0) {
+        fprintf(stderr, "reverse: write failed\n");
+        ret = 1;
     }
 
     if (in_stream != stdin) {
@@ -189,5 +326,5 @@ int main(int argc, char *argv[]) {
         fclose(out_stream);
     }
 
-    return 0;
+    return ret;
 }
\ No newline at end of file
@@ -0,0 +1,294 @@
+#! /usr/bin/env python3
+
+"""
+Benchmark suite for the project1 utilities.
+
+  bench.py gen [--dir DIR] [--sizes 1,16,64] [--seed N]
+      Write reproducible corpora (text, runs, random, sparse) of each size
+      in MB, plus a wzip archive of each for wunzip.
+
+  bench.py run [--dir DIR] [--out FILE.csv] [--repeat N] [--tools ...]
+               [--utils DIR]
+      Run every tool over every corpus and write one CSV row per run:
+      best wall time, throughput, peak RSS and read/write syscall counts.
+      --utils runs the binaries of another checkout's project1/utilities
+      (compare-revs.sh uses it to benchmark two revisions).
+
+  bench.py compare BASELINE.csv CURRENT.csv [--threshold PCT]
+      Flag rows whose throughput dropped, or whose peak RSS or syscall
+      count grew, by more than PCT percent. Exits 1 if any did.
+
+Build the tools first (make in each tool directory, and in this one for
+the measure helper).
+"""
+
+import argparse
+import csv
+import os
+import random
+import subprocess
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+UTILS = os.path.dirname(HERE)
+MEASURE = os.path.join(HERE, 'measure')
+
+# Binary of each tool, relative to a project1/utilities directory
+TOOLS = {
+    'wcat': os.path.join('wcat', 'wcat'),
+    'wgrep': os.path.join('wgrep', 'wgrep'),
+    'wzip': os.path.join('wzip', 'wzip'),
+    'wunzip': os.path.join('wunzip', 'wunzip'),
+    'reverse': os.path.join('..', 'reverse', 'reverse'),
+}
+
+
+def tool_path(tool, utils=UTILS):
+    return os.path.join(utils, TOOLS[tool])
+
+# (tool, workload name, argument list); {in} is the corpus, {z} its archive
+WORKLOADS = [
+    ('wcat', 'cat', ['{in}']),
+    ('wgrep', 'grep', ['the', '{in}']),
+    ('wgrep', 'grep-j4', ['-j', '4', 'the', '{in}']),
+    ('wzip', 'zip', ['{in}']),
+    ('wzip', 'zip-j4', ['-j', '4', '{in}']),
+    ('wzip', 'zip-v2', ['-2', '{in}']),
+    ('wunzip', 'unzip', ['{z}']),
+    ('reverse', 'reverse', ['{in}']),
+]
+
+KINDS = ['text', 'runs', 'random', 'sparse']
+
+FIELDS = ['tool', 'workload', 'corpus', 'bytes', 'seconds', 'mb_per_s',
+          'peak_rss_kb', 'read_syscalls', 'write_syscalls', 'exit_status']
+
+WORDS = ('the of and to in is was that for it with as his on be at by had '
+         'are but from or have an they which one you were her all she there '
+         'would their we him been has when who will more no if out so said '
+         'what up its about into than them can only other new some could '
+         'time these two may then do first any my now such like our over '
+         'man me even most made after also did many before must through '
+         'process thread kernel memory page file system lock buffer').split()
+
+
+def gen_text(rng, size, out):
+    """Lines of 4 to 16 words drawn from WORDS"""
+    written = 0
+    while written < size:
+        lines = []
+        for _ in range(4096):
+            lines.append(' '.join(rng.choices(WORDS, k=rng.randint(4, 16))))
+        block = ('\n'.join(lines) + '\n').encode()
+        out.write(block[:size - written])
+        written += len(block)
+
+
+def gen_runs(rng, size, out):
+    """Runs of 1 to 20 repeated letters, as in the wzip test generator"""
+    letters = b'abcdefghijklmnopqrstuvwxyz\n'
+    written = 0
+    while written < size:
+        block = bytearray()
+        for _ in range(65536):
+            block += bytes([rng.choice(letters)]) * rng.randint(1, 20)
+        out.write(bytes(block[:size - written]))
+        written += len(block)
+
+
+def gen_random(rng, size, out):
+    """Incompressible bytes"""
+    written = 0
+    while written < size:
+        n = min(1 << 20, size - written)
+        out.write(rng.randbytes(n))
+        written += n
+
+
+def gen_sparse(rng, size, out):
+    """4 KB blocks, zero except for 64 random bytes each"""
+    written = 0
+    while written < size:
+        n = min(4096, size - written)
+        out.write((bytes(4032) + rng.randbytes(64))[:n])
+        written += n
+
+
+GENERATORS = {
+    'text': gen_text,
+    'runs': gen_runs,
+    'random': gen_random,
+    'sparse': gen_sparse,
+}
+
+
+def corpora(directory):
+    """Corpus files in directory, smallest first"""
+    names = [f for f in os.listdir(directory)
+             if not f.endswith('.z') and f.split('-')[0] in KINDS]
+    return sorted(names, key=lambda f: (os.path.getsize(os.path.join(directory, f)), f))
+
+
+def cmd_gen(args):
+    os.makedirs(args.dir, exist_ok=True)
+    for size_mb in [int(s) for s in args.sizes.split(',')]:
+        for kind in KINDS:
+            path = os.path.join(args.dir, '%s-%dM' % (kind, size_mb))
+            # Seeded per corpus, so each file is the same on every machine
+            rng = random.Random('%d-%s-%d' % (args.seed, kind, size_mb))
+            with open(path, 'wb') as out:
+                GENERATORS[kind](rng, size_mb << 20, out)
+            with open(path + '.z', 'wb') as out:
+                subprocess.run([tool_path('wzip'), path], stdout=out, check=True)
+            print('wrote %s' % path)
+
+
+def run_once(argv):
+    """Run argv under the measure helper. Returns the measurements"""
+    result = subprocess.run([MEASURE] + argv, stdout=subprocess.PIPE,
+                            stderr=subprocess.DEVNULL, check=True)
+    fields = result.stdout.split()
+    return {
+        'seconds': float(fields[0]),
+        'peak_rss_kb': int(fields[1]),
+        'read_syscalls': int(fields[2]),
+        'write_syscalls': int(fields[3]),
+        'exit_status': int(fields[4]),
+    }
+
+
+def cmd_run(args):
+    tools = args.tools.split(',') if args.tools else list(TOOLS)
+    if not os.access(MEASURE, os.X_OK):
+        sys.exit('bench: run make in %s first' % HERE)
+    for tool in tools:
+        if not os.access(tool_path(tool, args.utils), os.X_OK):
+            sys.exit('bench: %s is not built (%s)' % (tool, tool_path(tool, args.utils)))
+    names = corpora(args.dir)
+    if not names:
+        sys.exit('bench: no corpora in %s; run "bench.py gen" first' % args.dir)
+
+    out = open(args.out, 'w', newline='') if args.out else sys.stdout
+    writer = csv.DictWriter(out, fieldnames=FIELDS)
+    writer.writeheader()
+    for name in names:
+        path = os.path.join(args.dir, name)
+        size = os.path.getsize(path)
+        for tool, workload, template in WORKLOADS:
+            if tool not in tools:
+                continue
+            argv = [tool_path(tool, args.utils)] + [a.format(**{'in': path, 'z': path + '.z'})
+                                    for a in template]
+            # Best of N: the first run also warms the page cache
+            runs = [run_once(argv) for _ in range(args.repeat)]
+            best = min(runs, key=lambda r: r['seconds'])
+            best.update({
+                'tool': tool,
+                'workload': workload,
+                'corpus': name,
+                'bytes': size,
+                'mb_per_s': '%.1f' % (size / best['seconds'] / 1e6),
+                'seconds': '%.4f' % best['seconds'],
+            })
+            writer.writerow(best)
+            out.flush()
+    if out is not sys.stdout:
+        out.close()
+
+
+def load(path):
+    with open(path, newline='') as f:
+        return {(r['tool'], r['workload'], r['corpus']): r for r in csv.DictReader(f)}
+
+
+def change(old, new):
+    """Relative change from old to new in percent, or None if unknown"""
+    try:
+        old, new = float(old), float(new)
+    except ValueError:
+        return None
+    return (new - old) / old * 100 if old > 0 else None
+
+
+def cmd_compare(args):
+    baseline = load(args.baseline)
+    current = load(args.current)
+    regressions = 0
+
+    print('%-8s %-8s %-12s %10s %10s %8s  %s' %
+          ('tool', 'workload', 'corpus', 'base MB/s', 'MB/s', 'change', 'flags'))
+    for key in sorted(current):
+        if key not in baseline:
+            continue
+        old, new = baseline[key], current[key]
+        flags = []
+        if old['exit_status'] != '0':
+            # The baseline cannot run this workload (an option it lacks)
+            print('%-8s %-8s %-12s not supported by the baseline' % key)
+            continue
+        speed = change(old['mb_per_s'], new['mb_per_s'])
+        # Runs this short are mostly process start-up and timer noise
+        timed = min(float(old['seconds']), float(new['seconds'])) >= args.min_seconds
+        if speed is not None and speed < -args.threshold and timed:
+            flags.append('SLOWER')
+        # Growth must also exceed a small absolute floor to count
+        for field, label, floor in (('peak_rss_kb', 'RSS', 1024),
+                                    ('read_syscalls', 'READS', 16),
+                                    ('write_syscalls', 'WRITES', 16)):
+            growth = change(old[field], new[field])
+            if (growth is not None and growth > args.threshold and
+                    float(new[field]) - float(old[field]) >= floor):
+                flags.append('%s+%.0f%%' % (label, growth))
+        if new['exit_status'] != old['exit_status']:
+            flags.append('EXIT %s' % new['exit_status'])
+        if flags:
+            regressions += 1
+        print('%-8s %-8s %-12s %10s %10s %7s%%  %s' %
+              (key + (old['mb_per_s'], new['mb_per_s'],
+                      '%+.1f' % speed if speed is not None else '?',
+                      ' '.join(flags))))
+
+    missing = sorted(set(baseline) - set(current))
+    for key in missing:
+        print('%-8s %-8s %-12s missing from %s' % (key + (args.current,)))
+    print('%d regression(s) beyond %.0f%%' % (regressions, args.threshold))
+    return 1 if regressions else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description='project1 utilities benchmark')
+    sub = parser.add_subparsers(dest='command', required=True)
+    default_dir = os.path.join(HERE, 'corpus')
+
+    gen = sub.add_parser('gen', help='generate corpora')
+    gen.add_argument('--dir', default=default_dir)
+    gen.add_argument('--sizes', default='1,16,64', help='comma-separated MB')
+    gen.add_argument('--seed', type=int, default=1)
+
+    run = sub.add_parser('run', help='run the benchmarks')
+    run.add_argument('--dir', default=default_dir)
+    run.add_argument('--out', help='CSV file (default: stdout)')
+    run.add_argument('--repeat', type=int, default=3)
+    run.add_argument('--tools', help='comma-separated subset of ' + ','.join(TOOLS))
+    run.add_argument('--utils', default=UTILS,
+                     help='project1/utilities directory whose binaries to run')
+
+    compare = sub.add_parser('compare', help='flag regressions against a baseline')
+    compare.add_argument('baseline')
+    compare.add_argument('current')
+    compare.add_argument('--threshold', type=float, default=10.0,
+                         help='tolerated change in percent (default 10)')
+    compare.add_argument('--min-seconds', type=float, default=0.05,
+                         help='ignore throughput changes of faster runs (default 0.05)')
+
+    args = parser.parse_args()
+    if args.command == 'gen':
+        cmd_gen(args)
+    elif args.command == 'run':
+        cmd_run(args)
+    else:
+        sys.exit(cmd_compare(args))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,57 @@
+#! /bin/bash
+
+# usage: compare-revs.sh BASE [HEAD] [bench.py run options ...]
+#
+# Benchmarks the real tool binaries of two git revisions against each
+# other: BASE and HEAD (default: the working tree) are checked out into
+# temporary worktrees, each tool is built with that revision's own
+# Makefile, both sets are run over the corpora by "bench.py run --utils",
+# and the results go through "bench.py compare". Run "bench.py gen" first.
+# Workloads that BASE does not support (e.g. -j before it existed) are
+# listed but not compared.
+
+set -e
+
+if [[ $# -lt 1 ]]; then
+    echo "usage: compare-revs.sh BASE [HEAD] [bench.py run options ...]"
+    exit 1
+fi
+
+here=$(cd "$(dirname "$0")" && pwd)
+base=$1
+shift
+head=
+if [[ $# -gt 0 && $1 != -* ]]; then
+    head=$1
+    shift
+fi
+
+make -s -C "$here"
+top=$(git -C "$here" rev-parse --show-toplevel)
+prefix=$(git -C "$here" rev-parse --show-prefix)    # project1/utilities/bench/
+workdir=$(mktemp -d)
+trap 'git -C "$top" worktree remove --force "$workdir/base" 2>/dev/null;
+      [[ -n $head ]] && git -C "$top" worktree remove --force "$workdir/head" 2>/dev/null;
+      rm -rf "$workdir"' EXIT
+
+# Build the tools of the checkout at $1; print its utilities directory
+build() {
+    local utils=$1/${prefix%bench/}
+    for tool in wcat wgrep wzip wunzip ../reverse; do
+        make -s -C "$utils/$tool" >/dev/null
+    done
+    echo "$utils"
+}
+
+git -C "$top" worktree add --detach -q "$workdir/base" "$base"
+base_utils=$(build "$workdir/base")
+if [[ -n $head ]]; then
+    git -C "$top" worktree add --detach -q "$workdir/head" "$head"
+    head_utils=$(build "$workdir/head")
+else
+    head_utils=$(build "$top")
+fi
+
+"$here/bench.py" run --utils "$base_utils" --out "$workdir/base.csv" "$@"
+"$here/bench.py" run --utils "$head_utils" --out "$workdir/head.csv" "$@"
+"$here/bench.py" compare "$workdir/base.csv" "$workdir/head.csv"
@@ -0,0 +1,100 @@
+/*
+ * Run a command and report what it cost, for bench.py:
+ *
+ *   measure command [args ...]
+ *
+ * The command's stdout goes to /dev/null; its stderr is left alone. One
+ * line is printed on stdout once it exits:
+ *
+ *   seconds peak_rss_kb read_syscalls write_syscalls exit_status
+ *
+ * Peak RSS comes from wait4(). The command has to be forked from a small
+ * process like this one: Linux carries the pre-exec high-water mark across
+ * execve(), so a child forked from the Python harness would report at least
+ * the interpreter's RSS. Syscall counts are the syscr/syscw fields of
+ * /proc/PID/io, read while the child is still a zombie.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Look up one "key: value" line of /proc/PID/io. Returns -1 if missing */
+static long long proc_io(pid_t pid, const char *key) {
+    char path[64];
+    char line[128];
+    long long value = -1;
+    size_t key_len = strlen(key);
+
+    snprintf(path, sizeof(path), "/proc/%d/io", (int) pid);
+    FILE *stream = fopen(path, "r");
+    if (stream == NULL) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), stream) != NULL) {
+        if (strncmp(line, key, key_len) == 0 && line[key_len] == ':') {
+            value = atoll(line + key_len + 1);
+            break;
+        }
+    }
+    fclose(stream);
+    return value;
+}
+
+int main(int argc, char *argv[]) {
+    siginfo_t info;
+    struct rusage usage;
+    int status;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: measure command [args ...]\n");
+        exit(1);
+    }
+
+    double start = now();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("measure: fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd < 0 || dup2(null_fd, STDOUT_FILENO) < 0) {
+            perror("measure: /dev/null");
+            _exit(127);
+        }
+        close(null_fd);
+        execv(argv[1], argv + 1);
+        perror("measure: exec");
+        _exit(127);
+    }
+
+    /* Leave the child a zombie so its /proc entry can still be read */
+    if (waitid(P_PID, pid, &info, WEXITED | WNOWAIT) != 0) {
+        perror("measure: waitid");
+        exit(1);
+    }
+    double elapsed = now() - start;
+    long long reads = proc_io(pid, "syscr");
+    long long writes = proc_io(pid, "syscw");
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        perror("measure: wait4");
+        exit(1);
+    }
+
+    printf("%.6f %ld %lld %lld %d\n", elapsed, usage.ru_maxrss, reads, writes,
+           WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+    return 0;
+}
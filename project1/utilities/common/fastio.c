@@ -0,0 +1,327 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "fastio.h"
+
+/* Writes at least this long go out straight from the caller's buffer */
+#define IO_DIRECT_WRITE (16 << 10)
+/* Runs at least this long are written from fill_page instead of staged */
+#define IO_DIRECT_FILL (16 << 10)
+#define FILL_PAGE_SIZE (64 << 10)
+
+void *io_alloc(size_t size) {
+    void *p;
+
+    if (posix_memalign(&p, IO_ALIGN, size) != 0) {
+        return NULL;
+    }
+    return p;
+}
+
+int io_map(int fd, char **data, size_t *len) {
+    struct stat st;
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        return -1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    *data = map;
+    *len = st.st_size;
+    return 0;
+}
+
+void io_unmap(char *data, size_t len) {
+    munmap(data, len);
+}
+
+int io_reader_open(io_reader *r, int fd, int flags) {
+    memset(r, 0, sizeof(*r));
+    r->fd = fd;
+    if (!(flags & IO_NO_MAP) && io_map(fd, &r->map, &r->map_len) == 0) {
+        return 0;
+    }
+
+    r->cap = IO_BUF_SIZE;
+    r->buf = io_alloc(r->cap);
+    return r->buf ? 0 : -1;
+}
+
+void io_reader_close(io_reader *r) {
+    if (r->map != NULL) {
+        io_unmap(r->map, r->map_len);
+    }
+    free(r->buf);
+    r->map = NULL;
+    r->buf = NULL;
+}
+
+/* Move unconsumed bytes to the front, growing the buffer if it is full */
+static int make_room(io_reader *r) {
+    if (r->start > 0) {
+        memmove(r->buf, r->buf + r->start, r->fill - r->start);
+        r->fill -= r->start;
+        r->start = 0;
+    }
+    if (r->fill == r->cap) {
+        char *grown = io_alloc(2 * r->cap);
+        if (grown == NULL) {
+            r->error = 1;
+            return -1;
+        }
+        memcpy(grown, r->buf, r->fill);
+        free(r->buf);
+        r->buf = grown;
+        r->cap *= 2;
+    }
+    return 0;
+}
+
+/* Append one read() to the buffer. Returns bytes read, 0 at EOF, -1 on error */
+static ssize_t fill_buffer(io_reader *r) {
+    while (1) {
+        ssize_t nread = read(r->fd, r->buf + r->fill, r->cap - r->fill);
+        if (nread < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            r->error = 1;
+            return -1;
+        }
+        if (nread == 0) {
+            r->eof = 1;
+        }
+        r->fill += nread;
+        return nread;
+    }
+}
+
+int io_next_block(io_reader *r, const char **data, size_t *len, int whole_lines) {
+    if (r->map != NULL) {
+        if (r->start >= r->map_len) {
+            return 0;
+        }
+        *data = r->map;
+        *len = r->map_len;
+        r->start = r->map_len;
+        return 1;
+    }
+
+    /* Drop the block handed out by the previous call */
+    size_t scanned = 0;
+    if (make_room(r) != 0) {
+        return -1;
+    }
+
+    while (1) {
+        if (r->fill > scanned) {
+            if (!whole_lines) {
+                r->start = r->fill;
+                break;
+            }
+            const char *nl = memrchr(r->buf + scanned, '\n', r->fill - scanned);
+            if (nl != NULL) {
+                r->start = nl + 1 - r->buf;
+                break;
+            }
+            scanned = r->fill;
+        }
+        if (r->eof) {
+            if (r->fill == 0) {
+                return 0;
+            }
+            r->start = r->fill;
+            break;
+        }
+        if (r->fill == r->cap && make_room(r) != 0) {
+            return -1;
+        }
+        if (fill_buffer(r) < 0) {
+            return -1;
+        }
+    }
+
+    *data = r->buf;
+    *len = r->start;
+    return 1;
+}
+
+int io_next_line(io_reader *r, const char **line, size_t *len) {
+    if (r->map != NULL) {
+        if (r->start >= r->map_len) {
+            return 0;
+        }
+        const char *nl = memchr(r->map + r->start, '\n', r->map_len - r->start);
+        size_t end = nl ? (size_t) (nl + 1 - r->map) : r->map_len;
+        *line = r->map + r->start;
+        *len = end - r->start;
+        r->start = end;
+        return 1;
+    }
+
+    size_t scanned = r->start;
+    while (1) {
+        const char *nl = memchr(r->buf + scanned, '\n', r->fill - scanned);
+        if (nl != NULL) {
+            size_t end = nl + 1 - r->buf;
+            *line = r->buf + r->start;
+            *len = end - r->start;
+            r->start = end;
+            return 1;
+        }
+        if (r->eof) {
+            if (r->start == r->fill) {
+                return 0;
+            }
+            *line = r->buf + r->start;
+            *len = r->fill - r->start;
+            r->start = r->fill;
+            return 1;
+        }
+
+        scanned = r->fill - r->start;
+        if (make_room(r) != 0 || fill_buffer(r) < 0) {
+            return -1;
+        }
+    }
+}
+
+int io_write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t nwritten = write(fd, p, len);
+        if (nwritten < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += nwritten;
+        len -= nwritten;
+    }
+    return 0;
+}
+
+int io_writer_open(io_writer *w, int fd) {
+    memset(w, 0, sizeof(*w));
+    w->fd = fd;
+    w->cap = IO_OUT_BUF_SIZE;
+    w->buf = io_alloc(w->cap);
+    return w->buf ? 0 : -1;
+}
+
+int io_writer_close(io_writer *w) {
+    io_flush(w);
+    free(w->buf);
+    w->buf = NULL;
+    return w->error ? -1 : 0;
+}
+
+int io_flush(io_writer *w) {
+    struct iovec *iov = w->iov;
+    int count = w->iovcnt;
+
+    while (count > 0 && !w->error) {
+        ssize_t nwritten = writev(w->fd, iov, count);
+        if (nwritten < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            w->error = 1;
+            break;
+        }
+        w->bytes += nwritten;
+
+        /* Skip fully written entries and trim a partially written one */
+        while (count > 0 && (size_t) nwritten >= iov->iov_len) {
+            nwritten -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *) iov->iov_base + nwritten;
+            iov->iov_len -= nwritten;
+        }
+    }
+
+    w->iovcnt = 0;
+    w->len = 0;
+    return w->error ? -1 : 0;
+}
+
+void io_write_ref(io_writer *w, const void *data, size_t len) {
+    if (len == 0) {
+        return;
+    }
+    if (w->iovcnt == IO_MAX_IOV) {
+        io_flush(w);
+    }
+    w->iov[w->iovcnt].iov_base = (void *) data;
+    w->iov[w->iovcnt].iov_len = len;
+    w->iovcnt++;
+}
+
+char *io_stage(io_writer *w, size_t len) {
+    if (w->len + len > w->cap || w->iovcnt == IO_MAX_IOV) {
+        io_flush(w);
+    }
+
+    char *dst = w->buf + w->len;
+    struct iovec *last = w->iovcnt ? &w->iov[w->iovcnt - 1] : NULL;
+    if (last != NULL && (char *) last->iov_base + last->iov_len == dst) {
+        last->iov_len += len;
+    } else {
+        w->iov[w->iovcnt].iov_base = dst;
+        w->iov[w->iovcnt].iov_len = len;
+        w->iovcnt++;
+    }
+    w->len += len;
+    return dst;
+}
+
+void io_write(io_writer *w, const void *data, size_t len) {
+    if (len >= IO_DIRECT_WRITE) {
+        io_write_ref(w, data, len);
+        io_flush(w);
+        return;
+    }
+    memcpy(io_reserve(w, len), data, len);
+}
+
+void io_fill(io_writer *w, char c, uint64_t count) {
+    static char fill_page[FILL_PAGE_SIZE];
+    static int fill_char = -1;
+
+    if (count < IO_DIRECT_FILL) {
+        memset(io_reserve(w, count), c, count);
+        return;
+    }
+
+    /* Every iovec points at the same page, IO_MAX_IOV pages per writev */
+    io_flush(w);
+    if (fill_char != (unsigned char) c) {
+        memset(fill_page, c, FILL_PAGE_SIZE);
+        fill_char = (unsigned char) c;
+    }
+    while (count > 0) {
+        while (count > 0 && w->iovcnt < IO_MAX_IOV) {
+            size_t n = count < FILL_PAGE_SIZE ? count : FILL_PAGE_SIZE;
+            w->iov[w->iovcnt].iov_base = fill_page;
+            w->iov[w->iovcnt].iov_len = n;
+            w->iovcnt++;
+            count -= n;
+        }
+        if (io_flush(w) != 0) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,135 @@
+#ifndef FASTIO_H
+#define FASTIO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/*
+ * High-throughput I/O shared by wcat, wgrep, wzip, wunzip and reverse:
+ * page-aligned read buffers, optional mmap of regular files, a line
+ * iterator that hands out slices of its buffer instead of copies, and an
+ * output writer that coalesces small writes and batches large ones into
+ * writev() calls.
+ */
+
+#define IO_BUF_SIZE (1 << 20)        /* read buffers */
+#define IO_OUT_BUF_SIZE (64 << 10)   /* writer staging area; stays in cache */
+#define IO_ALIGN 4096
+#define IO_MAX_IOV 1024     /* UIO_MAXIOV on Linux */
+
+/* ---- Input ---- */
+
+enum _io_reader_flags_ {
+    IO_NO_MAP = 1,          /* always read(), even for regular files */
+};
+
+typedef struct {
+    int fd;
+    char *map;              /* whole file when mapped, else NULL */
+    size_t map_len;
+    char *buf;              /* page-aligned read buffer */
+    size_t cap;
+    size_t start;           /* unconsumed bytes are buf[start..fill) */
+    size_t fill;
+    int eof;
+    int error;
+} io_reader;
+
+/* Page-aligned allocation; release with free(). Returns NULL on failure */
+void *io_alloc(size_t size);
+
+/* Map a regular, non-empty file read-only. Returns 0 on success */
+int io_map(int fd, char **data, size_t *len);
+void io_unmap(char *data, size_t len);
+
+/*
+ * Attach a reader to fd. Regular files are mapped unless IO_NO_MAP is set;
+ * everything else is read through an IO_BUF_SIZE aligned buffer.
+ * Returns 0 on success, -1 if out of memory.
+ */
+int io_reader_open(io_reader *r, int fd, int flags);
+
+/* Unmap or free the reader's buffer. Does not close the fd */
+void io_reader_close(io_reader *r);
+
+/*
+ * Return the next block of input in *data and *len. A mapped file comes
+ * back as a single block. With whole_lines set, every block ends in '\n'
+ * except possibly the last one of the input; the buffer grows if a single
+ * line does not fit. The block stays valid until the next call. Returns 1
+ * for a block, 0 at end of input, -1 on a read error.
+ */
+int io_next_block(io_reader *r, const char **data, size_t *len, int whole_lines);
+
+/*
+ * Return the next line, including its '\n' (the last line of the input may
+ * lack one), as a slice of the reader's buffer or mapping. The slice stays
+ * valid until the next call. Returns 1 for a line, 0 at end of input, -1 on
+ * a read error.
+ */
+int io_next_line(io_reader *r, const char **line, size_t *len);
+
+/* ---- Output ---- */
+
+typedef struct {
+    int fd;
+    char *buf;              /* staging area for small writes */
+    size_t cap;
+    size_t len;
+    struct iovec iov[IO_MAX_IOV];
+    int iovcnt;
+    uint64_t bytes;         /* total bytes written so far */
+    int error;
+} io_writer;
+
+/* Returns 0 on success, -1 if out of memory */
+int io_writer_open(io_writer *w, int fd);
+
+/* Flush and release the writer. Returns -1 if any write failed */
+int io_writer_close(io_writer *w);
+
+/* Write everything queued so far. Returns -1 on a write error */
+int io_flush(io_writer *w);
+
+/*
+ * Queue len bytes. Small writes are copied into the staging buffer; large
+ * ones are written straight from data together with whatever is already
+ * queued, in one writev(). data may be reused as soon as this returns.
+ */
+void io_write(io_writer *w, const void *data, size_t len);
+
+/*
+ * Queue len bytes without copying, e.g. a slice of a mapped file. data
+ * must stay valid until the next io_flush() or io_writer_close().
+ */
+void io_write_ref(io_writer *w, const void *data, size_t len);
+
+/*
+ * Reserve len (at most IO_OUT_BUF_SIZE) bytes at the end of the queue for the
+ * caller to fill in place. io_reserve() is the inline fast path for small
+ * records; it falls back to io_stage() when a new iovec or a flush is
+ * needed.
+ */
+char *io_stage(io_writer *w, size_t len);
+
+static inline char *io_reserve(io_writer *w, size_t len) {
+    if (w->iovcnt > 0 && w->len + len <= w->cap) {
+        struct iovec *last = &w->iov[w->iovcnt - 1];
+        char *dst = w->buf + w->len;
+        if ((char *) last->iov_base + last->iov_len == dst) {
+            last->iov_len += len;
+            w->len += len;
+            return dst;
+        }
+    }
+    return io_stage(w, len);
+}
+
+/* Queue count copies of c. Long runs are written from one pre-filled page */
+void io_fill(io_writer *w, char c, uint64_t count);
+
+/* write() all of buf to fd, retrying on short writes. Returns -1 on error */
+int io_write_all(int fd, const void *buf, size_t len);
+
+#endif
@@ -0,0 +1,415 @@
+/*
+ * Microbenchmark for fastio: runs the I/O pattern each utility used before
+ * (stdio, one byte or one line at a time) against its fastio replacement
+ * on the same input, and reports MB/s of input processed (for wunzip, of
+ * output, decoding a format 1 archive of the input). Output goes to
+ * /dev/null so only the I/O path itself is measured.
+ *
+ *   make && ./iobench FILE [ROUNDS]
+ *
+ * The kernels are copies of each tool's inner loop, so this isolates the
+ * I/O pattern. To measure the shipped binaries themselves, before and
+ * after a change, use ../bench/compare-revs.sh.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include "fastio.h"
+
+static const char *input_path;
+static char archive_path[] = "/tmp/iobench-XXXXXX";
+static int null_fd;
+static FILE *null_stream;
+
+/* Keeps the compiler from discarding work whose result is never printed */
+static volatile uint64_t sink;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static FILE *open_stream(void) {
+    FILE *stream = fopen(input_path, "r");
+    if (stream == NULL) {
+        fprintf(stderr, "iobench: cannot open file '%s'\n", input_path);
+        exit(1);
+    }
+    return stream;
+}
+
+static int open_fd(void) {
+    int fd = open(input_path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "iobench: cannot open file '%s'\n", input_path);
+        exit(1);
+    }
+    return fd;
+}
+
+static void open_writer(io_writer *w) {
+    if (io_writer_open(w, null_fd) != 0) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
+}
+
+static void open_reader(io_reader *r, int fd, int flags) {
+    if (io_reader_open(r, fd, flags) != 0) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
+}
+
+/* wcat: getline + printf vs. block reads written straight through */
+static void cat_before(void) {
+    FILE *stream = open_stream();
+    char *line = NULL;
+    size_t cap = 0;
+
+    while (getline(&line, &cap, stream) != -1) {
+        fprintf(null_stream, "%s", line);
+    }
+    fflush(null_stream);
+    free(line);
+    fclose(stream);
+}
+
+static void cat_after(void) {
+    int fd = open_fd();
+    io_reader r;
+    io_writer w;
+    const char *data;
+    size_t len;
+
+    open_reader(&r, fd, IO_NO_MAP);
+    open_writer(&w);
+    while (io_next_block(&r, &data, &len, 0) > 0) {
+        io_write(&w, data, len);
+    }
+    io_writer_close(&w);
+    io_reader_close(&r);
+    close(fd);
+}
+
+/* wgrep: getline + strstr per line vs. a search over whole-line blocks */
+static void grep_before(void) {
+    FILE *stream = open_stream();
+    char *line = NULL;
+    size_t cap = 0;
+
+    while (getline(&line, &cap, stream) != -1) {
+        if (strstr(line, "the") != NULL) {
+            fprintf(null_stream, "%s", line);
+        }
+    }
+    fflush(null_stream);
+    free(line);
+    fclose(stream);
+}
+
+static void grep_after(void) {
+    int fd = open_fd();
+    io_reader r;
+    io_writer w;
+    const char *data;
+    size_t len;
+
+    open_reader(&r, fd, 0);
+    open_writer(&w);
+    while (io_next_block(&r, &data, &len, 1) > 0) {
+        const char *pos = data;
+        const char *end = data + len;
+        const char *hit;
+
+        while ((hit = memmem(pos, end - pos, "the", 3)) != NULL) {
+            const char *line_start = memrchr(pos, '\n', hit - pos);
+            line_start = line_start ? line_start + 1 : pos;
+            const char *line_end = memchr(hit, '\n', end - hit);
+            line_end = line_end ? line_end + 1 : end;
+            io_write(&w, line_start, line_end - line_start);
+            pos = line_end;
+        }
+    }
+    io_writer_close(&w);
+    io_reader_close(&r);
+    close(fd);
+}
+
+/* wzip: fgetc + one fwrite per run vs. block scan into reserved space */
+static void zip_before(void) {
+    FILE *stream = open_stream();
+    int prev = EOF;
+    uint32_t count = 0;
+    int c;
+
+    while ((c = fgetc(stream)) != EOF) {
+        if (c == prev) {
+            count++;
+            continue;
+        }
+        if (count > 0) {
+            fwrite(&count, 4, 1, null_stream);
+            fputc(prev, null_stream);
+        }
+        prev = c;
+        count = 1;
+    }
+    if (count > 0) {
+        fwrite(&count, 4, 1, null_stream);
+        fputc(prev, null_stream);
+    }
+    fflush(null_stream);
+    fclose(stream);
+}
+
+static void zip_after(void) {
+    int fd = open_fd();
+    io_reader r;
+    io_writer w;
+    const char *data;
+    size_t len;
+    int prev = -1;
+    uint32_t count = 0;
+
+    open_reader(&r, fd, 0);
+    open_writer(&w);
+    while (io_next_block(&r, &data, &len, 0) > 0) {
+        for (size_t i = 0; i < len; i++) {
+            int c = (unsigned char) data[i];
+            if (c == prev) {
+                count++;
+                continue;
+            }
+            if (count > 0) {
+                char *rec = io_reserve(&w, 5);
+                memcpy(rec, &count, 4);
+                rec[4] = prev;
+            }
+            prev = c;
+            count = 1;
+        }
+    }
+    if (count > 0) {
+        char *rec = io_reserve(&w, 5);
+        memcpy(rec, &count, 4);
+        rec[4] = prev;
+    }
+    io_writer_close(&w);
+    io_reader_close(&r);
+    close(fd);
+}
+
+/* reverse: a linked list of getline copies vs. slices of the mapping */
+typedef struct line_node {
+    char *line;
+    struct line_node *next;
+} line_node;
+
+static void reverse_before(void) {
+    FILE *stream = open_stream();
+    line_node *head = NULL;
+    char *line = NULL;
+    size_t cap = 0;
+
+    while (getline(&line, &cap, stream) != -1) {
+        line_node *node = malloc(sizeof(line_node));
+        node->line = strdup(line);
+        node->next = head;
+        head = node;
+    }
+    while (head != NULL) {
+        line_node *next = head->next;
+        fprintf(null_stream, "%s", head->line);
+        free(head->line);
+        free(head);
+        head = next;
+    }
+    fflush(null_stream);
+    free(line);
+    fclose(stream);
+}
+
+static void reverse_after(void) {
+    int fd = open_fd();
+    io_writer w;
+    char *data;
+    size_t len;
+
+    open_writer(&w);
+    if (io_map(fd, &data, &len) == 0) {
+        size_t end = len;
+        while (end > 0) {
+            const char *nl = memrchr(data, '\n', end - 1);
+            size_t start = nl ? (size_t) (nl + 1 - data) : 0;
+            io_write_ref(&w, data + start, end - start);
+            end = start;
+        }
+        io_flush(&w);
+        io_unmap(data, len);
+    }
+    io_writer_close(&w);
+    close(fd);
+}
+
+/* wunzip: fread of one record + a printf per byte vs. io_fill */
+static void unzip_before(void) {
+    FILE *stream = fopen(archive_path, "r");
+    char record[5];
+
+    while (fread(record, 5, 1, stream)) {
+        uint32_t count;
+        memcpy(&count, record, 4);
+        for (uint32_t i = 0; i < count; i++) {
+            fprintf(null_stream, "%c", record[4]);
+        }
+    }
+    fflush(null_stream);
+    fclose(stream);
+}
+
+static void unzip_after(void) {
+    int fd = open(archive_path, O_RDONLY);
+    io_reader r;
+    io_writer w;
+    const char *data;
+    size_t len;
+    char partial[5];
+    size_t partial_len = 0;
+    uint32_t count;
+
+    open_reader(&r, fd, 0);
+    open_writer(&w);
+    while (io_next_block(&r, &data, &len, 0) > 0) {
+        size_t i = 0;
+        /* A record can straddle two blocks of a pipe or small buffer */
+        while (partial_len > 0 && partial_len < 5 && i < len) {
+            partial[partial_len++] = data[i++];
+        }
+        if (partial_len == 5) {
+            memcpy(&count, partial, 4);
+            io_fill(&w, partial[4], count);
+            partial_len = 0;
+        }
+        for (; i + 5 <= len; i += 5) {
+            memcpy(&count, data + i, 4);
+            io_fill(&w, data[i + 4], count);
+        }
+        while (i < len) {
+            partial[partial_len++] = data[i++];
+        }
+    }
+    io_writer_close(&w);
+    io_reader_close(&r);
+    close(fd);
+}
+
+/* Encode the input as a format 1 archive for the wunzip kernels */
+static void make_archive(const char *data, size_t size) {
+    int fd = mkstemp(archive_path);
+    io_writer w;
+    uint32_t count = 1;
+
+    if (fd < 0 || io_writer_open(&w, fd) != 0) {
+        fprintf(stderr, "iobench: cannot create '%s'\n", archive_path);
+        exit(1);
+    }
+    for (size_t i = 1; i <= size; i++) {
+        if (i < size && data[i] == data[i - 1] && count < UINT32_MAX) {
+            count++;
+            continue;
+        }
+        char *rec = io_reserve(&w, 5);
+        memcpy(rec, &count, 4);
+        rec[4] = data[i - 1];
+        count = 1;
+    }
+    if (io_writer_close(&w) != 0) {
+        fprintf(stderr, "iobench: cannot write '%s'\n", archive_path);
+        unlink(archive_path);
+        exit(1);
+    }
+    close(fd);
+}
+
+typedef struct {
+    const char *name;
+    void (*before)(void);
+    void (*after)(void);
+} kernel;
+
+static const kernel kernels[] = {
+    {"wcat", cat_before, cat_after},
+    {"wgrep", grep_before, grep_after},
+    {"wzip", zip_before, zip_after},
+    {"wunzip", unzip_before, unzip_after},
+    {"reverse", reverse_before, reverse_after},
+};
+
+/* Best of rounds runs, in MB/s of input */
+static double measure(void (*fn)(void), uint64_t size, int rounds) {
+    double best = 0;
+
+    for (int i = 0; i < rounds; i++) {
+        double start = now();
+        fn();
+        double elapsed = now() - start;
+        if (elapsed > 0 && size / elapsed / 1e6 > best) {
+            best = size / elapsed / 1e6;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char *argv[]) {
+    int rounds = 3;
+    char *data;
+    size_t size;
+
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "usage: iobench file [rounds]\n");
+        exit(1);
+    }
+    input_path = argv[1];
+    if (argc == 3 && (rounds = atoi(argv[2])) < 1) {
+        rounds = 1;
+    }
+
+    int fd = open_fd();
+    if (io_map(fd, &data, &size) != 0) {
+        fprintf(stderr, "iobench: '%s' must be a non-empty regular file\n", input_path);
+        exit(1);
+    }
+    /* Warm the page cache so every kernel reads from memory */
+    for (size_t i = 0; i < size; i += 4096) {
+        sink += data[i];
+    }
+    make_archive(data, size);
+    io_unmap(data, size);
+    close(fd);
+
+    null_fd = open("/dev/null", O_WRONLY);
+    null_stream = fdopen(null_fd, "w");
+    if (null_fd < 0 || null_stream == NULL) {
+        fprintf(stderr, "iobench: cannot open /dev/null\n");
+        exit(1);
+    }
+
+    printf("%-8s %12s %12s %8s\n", "tool", "stdio MB/s", "fastio MB/s", "speedup");
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        double before = measure(kernels[k].before, size, rounds);
+        double after = measure(kernels[k].after, size, rounds);
+        printf("%-8s %12.1f %12.1f %7.1fx\n", kernels[k].name, before, after,
+               before > 0 ? after / before : 0.0);
+    }
+
+    unlink(archive_path);
+    fclose(null_stream);
+    return 0;
+}
@@ -0,0 +1,120 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "prefetch.h"
+
+/* Number of files the I/O thread may open ahead of the consumer */
+#define PREFETCH_DEPTH 8
+
+typedef struct {
+    int fd;
+    int error;      /* errno from open(), valid when fd < 0 */
+} slot;
+
+struct prefetcher {
+    char **paths;
+    int num_paths;
+    slot slots[PREFETCH_DEPTH];
+    int opened;     /* paths[0..opened) have been opened */
+    int consumed;   /* paths[0..consumed) have been handed out */
+    int quit;
+
+    pthread_t tid;
+    pthread_mutex_t lock;
+    pthread_cond_t space_cv;
+    pthread_cond_t ready_cv;
+};
+
+static void *io_thread(void *arg) {
+    prefetcher *pf = arg;
+
+    for (int i = 0; i < pf->num_paths; i++) {
+        pthread_mutex_lock(&pf->lock);
+        while (i - pf->consumed >= PREFETCH_DEPTH && !pf->quit) {
+            pthread_cond_wait(&pf->space_cv, &pf->lock);
+        }
+        if (pf->quit) {
+            pthread_mutex_unlock(&pf->lock);
+            break;
+        }
+        pthread_mutex_unlock(&pf->lock);
+
+        slot s;
+        s.fd = open(pf->paths[i], O_RDONLY);
+        s.error = errno;
+        if (s.fd >= 0) {
+            /* Start pulling the whole file into the page cache */
+            posix_fadvise(s.fd, 0, 0, POSIX_FADV_WILLNEED);
+            posix_fadvise(s.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+
+        pthread_mutex_lock(&pf->lock);
+        pf->slots[i % PREFETCH_DEPTH] = s;
+        pf->opened++;
+        pthread_cond_signal(&pf->ready_cv);
+        pthread_mutex_unlock(&pf->lock);
+    }
+    return NULL;
+}
+
+prefetcher *prefetch_start(char **paths, int num_paths) {
+    prefetcher *pf = calloc(1, sizeof(prefetcher));
+    if (pf == NULL) {
+        return NULL;
+    }
+
+    pf->paths = paths;
+    pf->num_paths = num_paths;
+    pthread_mutex_init(&pf->lock, NULL);
+    pthread_cond_init(&pf->space_cv, NULL);
+    pthread_cond_init(&pf->ready_cv, NULL);
+    if (pthread_create(&pf->tid, NULL, io_thread, pf) != 0) {
+        free(pf);
+        return NULL;
+    }
+    return pf;
+}
+
+int prefetch_next(prefetcher *pf) {
+    slot s;
+
+    pthread_mutex_lock(&pf->lock);
+    if (pf->consumed >= pf->num_paths) {
+        pthread_mutex_unlock(&pf->lock);
+        errno = ENOENT;
+        return -1;
+    }
+    while (pf->opened <= pf->consumed) {
+        pthread_cond_wait(&pf->ready_cv, &pf->lock);
+    }
+    s = pf->slots[pf->consumed % PREFETCH_DEPTH];
+    pf->consumed++;
+    pthread_cond_signal(&pf->space_cv);
+    pthread_mutex_unlock(&pf->lock);
+
+    if (s.fd < 0) {
+        errno = s.error;
+    }
+    return s.fd;
+}
+
+void prefetch_stop(prefetcher *pf) {
+    pthread_mutex_lock(&pf->lock);
+    pf->quit = 1;
+    pthread_cond_signal(&pf->space_cv);
+    pthread_mutex_unlock(&pf->lock);
+    pthread_join(pf->tid, NULL);
+
+    for (int i = pf->consumed; i < pf->opened; i++) {
+        if (pf->slots[i % PREFETCH_DEPTH].fd >= 0) {
+            close(pf->slots[i % PREFETCH_DEPTH].fd);
+        }
+    }
+    pthread_mutex_destroy(&pf->lock);
+    pthread_cond_destroy(&pf->space_cv);
+    pthread_cond_destroy(&pf->ready_cv);
+    free(pf);
+}
@@ -0,0 +1,23 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+/*
+ * Opens the files named on the command line ahead of the consumer on a
+ * dedicated I/O thread and starts readahead on each one, so open() and the
+ * first read() of file i+1 overlap with the processing of file i.
+ */
+typedef struct prefetcher prefetcher;
+
+/* Start prefetching paths[0..num_paths). Returns NULL if out of memory */
+prefetcher *prefetch_start(char **paths, int num_paths);
+
+/*
+ * Return a read-only fd for the next path, in order. The caller owns it.
+ * Returns -1 with errno set if that path could not be opened.
+ */
+int prefetch_next(prefetcher *pf);
+
+/* Stop the I/O thread and close any fds that were never handed out */
+void prefetch_stop(prefetcher *pf);
+
+#endif
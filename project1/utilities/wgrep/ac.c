@@ -0,0 +1,229 @@
+#include <stdlib.h>
+#include <string.h>
+#include "ac.h"
+
+/* Trie used only while building; children are a singly linked list */
+typedef struct {
+    int32_t child;
+    int32_t sibling;
+    int32_t depth;
+    int32_t terminal;       /* pattern index, or -1 */
+    uint8_t c;
+} build_node;
+
+typedef struct {
+    build_node *nodes;
+    int32_t num_nodes;
+    int32_t cap;
+} trie;
+
+static int32_t new_node(trie *t, uint8_t c, int32_t depth) {
+    if (t->num_nodes == t->cap) {
+        int32_t cap = t->cap ? 2 * t->cap : 1024;
+        build_node *nodes = realloc(t->nodes, cap * sizeof(build_node));
+        if (nodes == NULL) {
+            return -1;
+        }
+        t->nodes = nodes;
+        t->cap = cap;
+    }
+
+    build_node *n = &t->nodes[t->num_nodes];
+    n->child = -1;
+    n->sibling = -1;
+    n->depth = depth;
+    n->terminal = -1;
+    n->c = c;
+    return t->num_nodes++;
+}
+
+static int insert(trie *t, const char *pattern, int32_t id) {
+    int32_t cur = 0;
+
+    for (const unsigned char *s = (const unsigned char *) pattern; *s; s++) {
+        int32_t next = t->nodes[cur].child;
+        while (next >= 0 && t->nodes[next].c != *s) {
+            next = t->nodes[next].sibling;
+        }
+        if (next < 0) {
+            next = new_node(t, *s, t->nodes[cur].depth + 1);
+            if (next < 0) {
+                return -1;
+            }
+            t->nodes[next].sibling = t->nodes[cur].child;
+            t->nodes[cur].child = next;
+        }
+        cur = next;
+    }
+    /* Keep the first occurrence of a duplicated pattern */
+    if (t->nodes[cur].terminal < 0) {
+        t->nodes[cur].terminal = id;
+    }
+    return 0;
+}
+
+static int compare_edges(const void *a, const void *b) {
+    return ((const ac_edge *) a)->c - ((const ac_edge *) b)->c;
+}
+
+static int32_t find_edge(const ac_automaton *a, const ac_node *n, uint8_t c) {
+    int32_t lo = n->first_edge;
+    int32_t hi = n->first_edge + n->num_edges;
+
+    while (lo < hi) {
+        int32_t mid = (lo + hi) / 2;
+        if (a->edges[mid].c == c) {
+            return a->edges[mid].next;
+        }
+        if (a->edges[mid].c < c) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return -1;
+}
+
+static inline int32_t step(const ac_automaton *a, int32_t s, uint8_t c) {
+    while (1) {
+        if (s < a->num_dense) {
+            return a->dense[s * 256 + c];
+        }
+        const ac_node *n = &a->nodes[s];
+        int32_t next = find_edge(a, n, c);
+        if (next >= 0) {
+            return next;
+        }
+        s = n->fail;
+    }
+}
+
+ac_automaton *ac_build(char **patterns, int32_t num_patterns) {
+    trie t = {NULL, 0, 0};
+    ac_automaton *a = calloc(1, sizeof(ac_automaton));
+    int32_t *queue = NULL;
+
+    if (a == NULL || new_node(&t, 0, 0) < 0) {
+        goto fail;
+    }
+    for (int32_t i = 0; i < num_patterns; i++) {
+        if (insert(&t, patterns[i], i) != 0) {
+            goto fail;
+        }
+    }
+
+    a->patterns = patterns;
+    a->num_patterns = num_patterns;
+    a->num_nodes = t.num_nodes;
+    a->nodes = calloc(t.num_nodes, sizeof(ac_node));
+    a->edges = calloc(t.num_nodes, sizeof(ac_edge));
+    queue = malloc(t.num_nodes * sizeof(int32_t));
+    if (a->nodes == NULL || a->edges == NULL || queue == NULL) {
+        goto fail;
+    }
+
+    /*
+     * Renumber nodes in BFS order: queue[id] is the trie node that becomes
+     * node id. Every node's failure target then gets an id below its own,
+     * and the dense (shallow) nodes are exactly the ids below num_dense.
+     */
+    int32_t head = 0;
+    int32_t tail = 0;
+    int32_t num_edges = 0;
+    queue[tail++] = 0;
+    while (head < tail) {
+        int32_t id = head++;
+        ac_node *n = &a->nodes[id];
+
+        n->first_edge = num_edges;
+        for (int32_t c = t.nodes[queue[id]].child; c >= 0; c = t.nodes[c].sibling) {
+            a->edges[num_edges].c = t.nodes[c].c;
+            a->edges[num_edges].next = tail;
+            num_edges++;
+            queue[tail++] = c;
+        }
+        n->num_edges = num_edges - n->first_edge;
+        qsort(a->edges + n->first_edge, n->num_edges, sizeof(ac_edge), compare_edges);
+        if (t.nodes[queue[id]].depth < AC_DENSE_DEPTH) {
+            a->num_dense++;
+        }
+    }
+
+    a->dense = malloc((size_t) a->num_dense * 256 * sizeof(int32_t));
+    if (a->dense == NULL) {
+        goto fail;
+    }
+
+    a->nodes[0].fail = 0;
+    for (int32_t id = 0; id < tail; id++) {
+        build_node *b = &t.nodes[queue[id]];
+        ac_node *n = &a->nodes[id];
+
+        if (b->depth > 1) {
+            /* Parent's failure target followed by the edge into this node */
+            n->fail = step(a, n->fail, b->c);
+        }
+        n->out = b->terminal >= 0 ? b->terminal :
+                 (id == 0 ? -1 : a->nodes[n->fail].out);
+
+        if (id < a->num_dense) {
+            int32_t *row = &a->dense[id * 256];
+            for (int c = 0; c < 256; c++) {
+                int32_t next = find_edge(a, n, c);
+                if (next >= 0) {
+                    row[c] = next;
+                } else {
+                    row[c] = id == 0 ? 0 : step(a, n->fail, c);
+                }
+            }
+        }
+
+        /* Stash this node's failure target in its children for the step above */
+        for (int32_t e = n->first_edge; e < n->first_edge + n->num_edges; e++) {
+            a->nodes[a->edges[e].next].fail = n->fail;
+        }
+    }
+
+    free(queue);
+    free(t.nodes);
+    return a;
+
+fail:
+    free(queue);
+    free(t.nodes);
+    ac_free(a);
+    return NULL;
+}
+
+const char *ac_find(const ac_automaton *a, const char *s, size_t len, int32_t *id) {
+    const uint8_t *p = (const uint8_t *) s;
+    int32_t state = 0;
+
+    if (a->nodes[0].out >= 0) {
+        /* The empty pattern matches at the start of every line */
+        *id = a->nodes[0].out;
+        return len > 0 ? s : NULL;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (state < a->num_dense) {
+            state = a->dense[state * 256 + p[i]];
+        } else {
+            state = step(a, state, p[i]);
+        }
+        if (a->nodes[state].out >= 0) {
+            *id = a->nodes[state].out;
+            return s + i;
+        }
+    }
+    return NULL;
+}
+
+void ac_free(ac_automaton *a) {
+    if (a == NULL) {
+        return;
+    }
+    free(a->nodes);
+    free(a->edges);
+    free(a->dense);
+    free(a);
+}
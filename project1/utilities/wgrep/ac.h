@@ -0,0 +1,57 @@
+#ifndef AC_H
+#define AC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Aho-Corasick automaton for matching many search terms in one pass.
+ * Nodes shallower than AC_DENSE_DEPTH carry a full 256-entry transition
+ * table (with failure transitions folded in), which covers almost every
+ * step on real text. Deeper nodes keep a sorted, sparse edge list and fall
+ * back along their failure link on a miss.
+ */
+#define AC_DENSE_DEPTH 2
+
+typedef struct {
+    int32_t fail;
+    int32_t first_edge;     /* children in ac_automaton.edges */
+    uint16_t num_edges;
+    int32_t out;            /* pattern ending here or at a suffix, or -1 */
+} ac_node;
+
+typedef struct {
+    uint8_t c;
+    int32_t next;
+} ac_edge;
+
+typedef struct {
+    ac_node *nodes;
+    int32_t num_nodes;
+    ac_edge *edges;
+    /*
+     * Nodes are numbered in BFS order, so the ids below num_dense are
+     * the shallow nodes and node i's transitions are dense[i * 256 .. +256).
+     */
+    int32_t *dense;
+    int32_t num_dense;
+    char **patterns;
+    int32_t num_patterns;
+} ac_automaton;
+
+/*
+ * Build an automaton over patterns[0..num_patterns). The automaton keeps
+ * the pattern pointers (for reporting) but does not copy the strings.
+ * Returns NULL if out of memory.
+ */
+ac_automaton *ac_build(char **patterns, int32_t num_patterns);
+
+/*
+ * Return a pointer to the last byte of the first match in s[0..len) and
+ * store the index of the matched pattern in *id, or return NULL.
+ */
+const char *ac_find(const ac_automaton *a, const char *s, size_t len, int32_t *id);
+
+void ac_free(ac_automaton *a);
+
+#endif
@@ -0,0 +1,57 @@
+#! /bin/bash
+
+# usage: bench-wgrep-patterns.sh [size-in-MB]
+#
+# Times `wgrep -f` over a reproducible corpus with 1, 100 and 10,000 search
+# terms, and compares it with running plain `wgrep` once per term.
+
+if ! [[ -x wgrep ]]; then
+    echo "wgrep executable does not exist"
+    exit 1
+fi
+
+size_mb=${1:-256}
+benchdir=$(mktemp -d)
+trap 'rm -rf $benchdir' EXIT
+
+awk -v bytes=$((size_mb * 1024 * 1024)) 'BEGIN {
+    srand(42)
+    n = split("alpha beta gamma delta error warn info debug trace fatal", words)
+    for (total = 0; total < bytes; total += length(line) + 1) {
+        line = ""
+        for (w = int(rand() * 12) + 4; w > 0; w--) {
+            line = line words[int(rand() * n) + 1] int(rand() * 100000) " "
+        }
+        print line
+    }
+}' > $benchdir/corpus
+
+# Terms are whole corpus tokens, trailing space included, drawn from the same
+# 10 words x 100,000 numbers. The default corpus has about 20 copies of each
+# of those million tokens, so practically every term hits.
+for count in 1 100 10000; do
+    awk -v count=$count 'BEGIN {
+        srand(count)
+        n = split("alpha beta gamma delta error warn info debug trace fatal", words)
+        for (i = 0; i < count; i++) {
+            print words[int(rand() * n) + 1] int(rand() * 100000) " "
+        }
+    }' > $benchdir/patterns.$count
+done
+
+# time_ns command... : prints elapsed nanoseconds
+time_ns () {
+    local start=$(date +%s%N)
+    "$@" > /dev/null
+    local end=$(date +%s%N)
+    echo $((end - start))
+}
+
+single_ns=$(time_ns ./wgrep "$(head -1 $benchdir/patterns.1)" $benchdir/corpus)
+
+printf "%-10s %10s %10s %22s\n" patterns seconds "MB/s" "one-pass-per-term est"
+for count in 1 100 10000; do
+    ns=$(time_ns ./wgrep -f $benchdir/patterns.$count $benchdir/corpus)
+    awk -v c=$count -v ns=$ns -v single=$single_ns -v mb=$size_mb \
+        'BEGIN { printf "%-10d %10.3f %10.1f %20.1f s\n", c, ns / 1e9, mb / (ns / 1e9), c * single / 1e9 }'
+done
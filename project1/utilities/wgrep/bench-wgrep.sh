@@ -0,0 +1,54 @@
+#! /bin/bash
+
+# usage: bench-wgrep.sh [max-threads] [size-in-MB]
+#
+# Generates a reproducible corpus (one large file plus many small ones) and
+# times `wgrep -j N` for N = 1, 2, 4, ... up to max-threads, checking that
+# every run prints exactly what the serial run prints.
+
+if ! [[ -x wgrep ]]; then
+    echo "wgrep executable does not exist"
+    exit 1
+fi
+
+max_threads=${1:-$(nproc)}
+size_mb=${2:-256}
+benchdir=$(mktemp -d)
+trap 'rm -rf $benchdir' EXIT
+
+awk -v bytes=$((size_mb * 1024 * 1024)) 'BEGIN {
+    srand(42)
+    n = split("alpha beta gamma delta error warn info debug trace fatal", words)
+    for (total = 0; total < bytes; total += length(line) + 1) {
+        line = ""
+        for (w = int(rand() * 12) + 4; w > 0; w--) {
+            line = line words[int(rand() * n) + 1] int(rand() * 100000) " "
+        }
+        if (rand() < 0.001) {
+            line = line "needle"
+        }
+        print line
+    }
+}' > $benchdir/big
+mkdir $benchdir/small
+split -n l/512 $benchdir/big $benchdir/small/part.
+
+./wgrep needle $benchdir/big $benchdir/small/part.* > $benchdir/expected
+
+printf "%-8s %10s %10s %8s\n" threads seconds "MB/s" speedup
+base_ns=0
+for ((j = 1; j <= max_threads; j *= 2)); do
+    start=$(date +%s%N)
+    ./wgrep -j $j needle $benchdir/big $benchdir/small/part.* > $benchdir/out
+    end=$(date +%s%N)
+    if ! cmp -s $benchdir/out $benchdir/expected; then
+        echo "-j $j: output differs from serial run"
+        exit 1
+    fi
+    ns=$((end - start))
+    if (( base_ns == 0 )); then
+        base_ns=$ns
+    fi
+    awk -v j=$j -v ns=$ns -v base=$base_ns -v mb=$((2 * size_mb)) \
+        'BEGIN { printf "%-8d %10.3f %10.1f %7.2fx\n", j, ns / 1e9, mb / (ns / 1e9), base / ns }'
+done
@@ -1,65 +1,477 @@
 //Your code goes here..!
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdint.h>
-#include <errno.h>
 #include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "ac.h"
+#include "../common/fastio.h"
 
-int main(int argc, char *argv[]) {
-    FILE *in_stream = NULL;
-    size_t nread = 0;
-    size_t len = 0;
-    char *line = NULL;
-    char *strstr_ret;
-    char *needle = NULL;
-
-    switch (argc) {
-        case 1: //Error
-            fprintf(stdout, "wgrep: searchterm [file ...]\n");
+/* Large files are split into newline-aligned tasks of about this size */
+#define CHUNK_SIZE (8 << 20)
+#define MAX_THREADS 256
+
+/* Matched lines go either straight to a writer or into a growable buffer */
+typedef struct {
+    io_writer *writer;
+    char *data;
+    size_t len;
+    size_t cap;
+} output;
+
+typedef struct {
+    const char *str;
+    size_t len;
+    /* A '\n' before the last byte means no single line can ever match */
+    int impossible;
+    /* Set with -f: match any of several terms instead of str */
+    const ac_automaton *ac;
+    /* Set with -p: prefix each line with the term that matched */
+    int report;
+} pattern;
+
+/* Return the first occurrence of p in s[0..len), or NULL */
+static const char *find_match(const char *s, size_t len, const pattern *p) {
+    size_t n = p->len;
+    size_t i = 0;
+
+    if (n == 1) {
+        return memchr(s, p->str[0], len);
+    }
+    if (len < n) {
+        return NULL;
+    }
+
+#ifdef __SSE2__
+    /*
+     * Compare the first and the last byte of the needle against 16
+     * candidate positions at once; only positions where both agree are
+     * confirmed with memcmp.
+     */
+    __m128i first = _mm_set1_epi8(p->str[0]);
+    __m128i last = _mm_set1_epi8(p->str[n-1]);
+    while (i + n - 1 + 16 <= len) {
+        __m128i block_first = _mm_loadu_si128((const __m128i *) (s + i));
+        __m128i block_last = _mm_loadu_si128((const __m128i *) (s + i + n - 1));
+        uint32_t mask = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(first, block_first),
+                          _mm_cmpeq_epi8(last, block_last)));
+        while (mask != 0) {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(s + i + bit + 1, p->str + 1, n - 2) == 0) {
+                return s + i + bit;
+            }
+            mask &= mask - 1;
+        }
+        i += 16;
+    }
+#endif
+
+    return memmem(s + i, len - i, p->str, n);
+}
+
+static void emit(output *out, const char *s, size_t n) {
+    if (out->writer != NULL) {
+        io_write(out->writer, s, n);
+        return;
+    }
+
+    if (out->len + n > out->cap) {
+        size_t cap = out->cap ? out->cap : 4096;
+        while (cap < out->len + n) {
+            cap *= 2;
+        }
+        out->data = realloc(out->data, cap);
+        if (out->data == NULL) {
+            fprintf(stderr, "malloc failed\n");
             exit(1);
-        case 2: //read from stdin
-            in_stream = stdin;
-            needle = argv[1];
-            break;
-        case 3: //read from file
-            needle = argv[1];
+        }
+        out->cap = cap;
+    }
+    memcpy(out->data + out->len, s, n);
+    out->len += n;
+}
+
+/*
+ * Emit every line of buf[0..len) that contains the pattern. buf holds
+ * whole lines, except that the final one may lack its '\n' at end of input.
+ */
+static void grep_buffer(const char *buf, size_t len, const pattern *p,
+                        output *out) {
+    const char *end = buf + len;
+    const char *pos = buf;
+
+    if (p->ac == NULL) {
+        if (p->impossible) {
+            return;
+        }
+        if (p->len == 0) {
+            /* strstr() matches the empty string on every line */
+            emit(out, buf, len);
+            return;
+        }
+    }
+
+    while (pos < end) {
+        int32_t id = -1;
+        const char *hit = p->ac ? ac_find(p->ac, pos, end - pos, &id) :
+                                  find_match(pos, end - pos, p);
+        if (hit == NULL) {
             break;
-        default:
+        }
+
+        const char *line_start = memrchr(buf, '\n', hit - buf);
+        line_start = line_start ? line_start + 1 : buf;
+        const char *line_end = memchr(hit, '\n', end - hit);
+        line_end = line_end ? line_end + 1 : end;
+
+        if (p->report && id >= 0) {
+            emit(out, p->ac->patterns[id], strlen(p->ac->patterns[id]));
+            emit(out, ":", 1);
+        }
+        emit(out, line_start, line_end - line_start);
+        pos = line_end;
+    }
+}
+
+/*
+ * Search fd one block of whole lines at a time; a regular file is mapped
+ * and searched as a single block.
+ */
+static int grep_fd(int fd, const pattern *p, output *out) {
+    io_reader r;
+    const char *data;
+    size_t len;
+    int ret;
+
+    if (io_reader_open(&r, fd, 0) != 0) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
+    while ((ret = io_next_block(&r, &data, &len, 1)) > 0) {
+        grep_buffer(data, len, p, out);
+    }
+    io_reader_close(&r);
+    return ret;
+}
+
+/*
+ * Parallel mode (-j N). Every file argument becomes one task, except that
+ * large regular files are mapped once and split into newline-aligned
+ * chunks, one task each. Workers fill a private output buffer per task and
+ * the main thread writes the buffers out in task order, so the result is
+ * byte-identical to a serial run.
+ */
+enum _task_type_ {
+    TASK_FILE = 1,      /* open and search a whole file */
+    TASK_CHUNK,         /* search a slice of a mapped file */
+};
+
+typedef struct {
+    int type;
+    const char *path;
+    const char *data;   /* TASK_CHUNK: slice of the mapping */
+    size_t len;
+    char *unmap;        /* set on the last chunk of a mapping */
+    size_t unmap_len;
+    int open_failed;
+    int done;
+    output out;
+} task;
+
+typedef struct {
+    task *tasks;
+    uint32_t num_tasks;
+    uint32_t next_task;     /* next task a worker will claim */
+    uint32_t emitted;       /* tasks[0..emitted) have been written out */
+    uint32_t window;        /* max tasks in flight ahead of the writer */
+    const pattern *p;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_cv;
+    pthread_cond_t done_cv;
+} task_queue;
+
+static void *grep_worker(void *arg) {
+    task_queue *q = arg;
+
+    while (1) {
+        pthread_mutex_lock(&q->lock);
+        while (q->next_task < q->num_tasks &&
+               q->next_task >= q->emitted + q->window) {
+            pthread_cond_wait(&q->work_cv, &q->lock);
+        }
+        if (q->next_task >= q->num_tasks) {
+            pthread_mutex_unlock(&q->lock);
             break;
-    };
+        }
+        task *t = &q->tasks[q->next_task++];
+        pthread_mutex_unlock(&q->lock);
 
-    if (in_stream == stdin) {
-        while ((nread = getline(&line, &len, in_stream)) != -1) {
-            strstr_ret = strstr(line, needle);
-            if (strstr_ret) {
-                fprintf(stdout, "%s", line);
+        if (t->type == TASK_CHUNK) {
+            grep_buffer(t->data, t->len, q->p, &t->out);
+        } else {
+            int fd = open(t->path, O_RDONLY);
+            if (fd < 0) {
+                t->open_failed = 1;
+            } else {
+                grep_fd(fd, q->p, &t->out);
+                close(fd);
             }
         }
 
-        free(line);
-    } else {
-        for (uint32_t i = 2; i < argc; i++) {
-            in_stream = fopen(argv[i], "r");
-            if (in_stream == NULL) {
-                fprintf(stdout, "wgrep: cannot open file\n");
+        pthread_mutex_lock(&q->lock);
+        t->done = 1;
+        pthread_cond_broadcast(&q->done_cv);
+        pthread_mutex_unlock(&q->lock);
+    }
+    return NULL;
+}
+
+static void add_task(task **tasks, uint32_t *num_tasks, uint32_t *cap, task *t) {
+    if (*num_tasks == *cap) {
+        *cap = *cap ? 2 * *cap : 64;
+        *tasks = realloc(*tasks, *cap * sizeof(task));
+        if (*tasks == NULL) {
+            fprintf(stderr, "malloc failed\n");
+            exit(1);
+        }
+    }
+    (*tasks)[(*num_tasks)++] = *t;
+}
+
+/* Split the mapped file into newline-aligned CHUNK_SIZE tasks */
+static void add_chunks(task **tasks, uint32_t *num_tasks, uint32_t *cap,
+                       const char *map, size_t size) {
+    size_t off = 0;
+
+    while (off < size) {
+        task t;
+        size_t end = off + CHUNK_SIZE;
+        if (end >= size) {
+            end = size;
+        } else {
+            const char *nl = memchr(map + end, '\n', size - end);
+            end = nl ? (size_t) (nl + 1 - map) : size;
+        }
+
+        memset(&t, 0, sizeof(t));
+        t.type = TASK_CHUNK;
+        t.data = map + off;
+        t.len = end - off;
+        if (end == size) {
+            t.unmap = (char *) map;
+            t.unmap_len = size;
+        }
+        add_task(tasks, num_tasks, cap, &t);
+        off = end;
+    }
+}
+
+static int parallel_grep(char **paths, int num_paths, const pattern *p,
+                         uint32_t num_threads, io_writer *w) {
+    task_queue q;
+    task *tasks = NULL;
+    uint32_t num_tasks = 0;
+    uint32_t cap = 0;
+    pthread_t tids[MAX_THREADS];
+
+    for (int i = 0; i < num_paths; i++) {
+        struct stat st;
+        task t;
+
+        if (stat(paths[i], &st) == 0 && S_ISREG(st.st_mode) &&
+            st.st_size > CHUNK_SIZE) {
+            int fd = open(paths[i], O_RDONLY);
+            char *map;
+            size_t map_len;
+            if (fd >= 0 && io_map(fd, &map, &map_len) == 0) {
+                close(fd);
+                add_chunks(&tasks, &num_tasks, &cap, map, map_len);
+                continue;
+            }
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+
+        /* Small files, pipes, and anything that could not be mapped */
+        memset(&t, 0, sizeof(t));
+        t.type = TASK_FILE;
+        t.path = paths[i];
+        add_task(&tasks, &num_tasks, &cap, &t);
+    }
+
+    memset(&q, 0, sizeof(q));
+    q.tasks = tasks;
+    q.num_tasks = num_tasks;
+    q.window = 4 * num_threads;
+    q.p = p;
+    pthread_mutex_init(&q.lock, NULL);
+    pthread_cond_init(&q.work_cv, NULL);
+    pthread_cond_init(&q.done_cv, NULL);
+    for (uint32_t i = 0; i < num_threads; i++) {
+        pthread_create(&tids[i], NULL, grep_worker, &q);
+    }
+
+    for (uint32_t i = 0; i < num_tasks; i++) {
+        task *t = &tasks[i];
+
+        pthread_mutex_lock(&q.lock);
+        while (!t->done) {
+            pthread_cond_wait(&q.done_cv, &q.lock);
+        }
+        pthread_mutex_unlock(&q.lock);
+
+        if (t->open_failed) {
+            io_flush(w);
+            fprintf(stdout, "wgrep: cannot open file\n");
+            exit(1);
+        }
+        io_write(w, t->out.data, t->out.len);
+        free(t->out.data);
+        if (t->unmap != NULL) {
+            io_unmap(t->unmap, t->unmap_len);
+        }
+
+        pthread_mutex_lock(&q.lock);
+        q.emitted++;
+        pthread_cond_broadcast(&q.work_cv);
+        pthread_mutex_unlock(&q.lock);
+    }
+
+    for (uint32_t i = 0; i < num_threads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    pthread_mutex_destroy(&q.lock);
+    pthread_cond_destroy(&q.work_cv);
+    pthread_cond_destroy(&q.done_cv);
+    free(tasks);
+    return 0;
+}
+
+/* Read one search term per line of path. Returns the number read */
+static int32_t read_patterns(const char *path, char ***patterns) {
+    int fd = open(path, O_RDONLY);
+    io_reader r;
+    const char *line;
+    size_t len;
+    int32_t num = 0;
+    int32_t cap = 0;
+
+    if (fd < 0) {
+        fprintf(stdout, "wgrep: cannot open file\n");
+        exit(1);
+    }
+    if (io_reader_open(&r, fd, 0) != 0) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
+
+    *patterns = NULL;
+    while (io_next_line(&r, &line, &len) > 0) {
+        if (len > 0 && line[len-1] == '\n') {
+            len--;
+        }
+        if (num == cap) {
+            cap = cap ? 2 * cap : 64;
+            *patterns = realloc(*patterns, cap * sizeof(char *));
+            if (*patterns == NULL) {
+                fprintf(stderr, "malloc failed\n");
                 exit(1);
             }
+        }
+        (*patterns)[num++] = strndup(line, len);
+    }
+
+    io_reader_close(&r);
+    close(fd);
+    return num;
+}
 
-            while ((nread = getline(&line, &len, in_stream)) != -1) {
-                strstr_ret = strstr(line, needle);
-                if (strstr_ret) {
-                    fprintf(stdout, "%s", line);
+int main(int argc, char *argv[]) {
+    pattern needle;
+    io_writer writer;
+    output out = {&writer, NULL, 0, 0};
+    uint32_t num_threads = 0;
+    char *pattern_file = NULL;
+    char **patterns = NULL;
+    int32_t num_patterns = 0;
+    int opt;
+
+    memset(&needle, 0, sizeof(needle));
+    while ((opt = getopt(argc, argv, "+j:f:p")) != -1) {
+        switch (opt) {
+            case 'j':
+                num_threads = atoi(optarg);
+                if (num_threads < 1 || num_threads > MAX_THREADS) {
+                    fprintf(stdout, "wgrep: -j must be between 1 and %d\n", MAX_THREADS);
+                    exit(1);
                 }
-            }
+                break;
+            case 'f':
+                pattern_file = optarg;
+                break;
+            case 'p':
+                needle.report = 1;
+                break;
+            default:
+                fprintf(stdout, "wgrep: [-j threads] [-f patternfile [-p]] searchterm [file ...]\n");
+                exit(1);
+        }
+    }
 
-            free(line);
+    /* Without -f, the first operand is the search term */
+    int first_file = pattern_file ? optind : optind + 1;
+    if (first_file > argc) {
+        fprintf(stdout, "wgrep: searchterm [file ...]\n");
+        exit(1);
+    }
+
+    if (pattern_file != NULL) {
+        num_patterns = read_patterns(pattern_file, &patterns);
+        needle.ac = ac_build(patterns, num_patterns);
+        if (needle.ac == NULL) {
+            fprintf(stderr, "malloc failed\n");
+            exit(1);
         }
+    } else {
+        needle.str = argv[optind];
+        needle.len = strlen(needle.str);
+        const char *nl = memchr(needle.str, '\n', needle.len);
+        needle.impossible = nl != NULL && nl != needle.str + needle.len - 1;
     }
 
+    if (io_writer_open(&writer, STDOUT_FILENO) != 0) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
 
-    return 0;
-}
\ No newline at end of file
+    if (first_file == argc) {
+        grep_fd(STDIN_FILENO, &needle, &out);
+    } else if (num_threads > 0) {
+        parallel_grep(argv + first_file, argc - first_file, &needle, num_threads, &writer);
+    } else {
+        for (int i = first_file; i < argc; i++) {
+            int fd = open(argv[i], O_RDONLY);
+            if (fd < 0) {
+                io_flush(&writer);
+                fprintf(stdout, "wgrep: cannot open file\n");
+                exit(1);
+            }
+            grep_fd(fd, &needle, &out);
+            close(fd);
+        }
+    }
+
+    return io_writer_close(&writer) != 0;
+}
@@ -4,35 +4,362 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <errno.h>
+#include <limits.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include "../common/fastio.h"
+#include "../common/prefetch.h"
+
+#define INDEX_MAGIC "WZI1"
+/* Magic of a format 2 archive (must match wzip.c); see decode_v2() */
+#define V2_MAGIC "\x89WZ2"
+
+/* Header of the index sidecar written by `wzip -x` (must match wzip.c) */
+typedef struct {
+    char magic[4];
+    uint32_t interval;
+    uint64_t num_records;
+    uint64_t total_bytes;
+} index_header;
+
+static io_writer out;
+
+/*
+ * Only bytes [skip, skip + left) of the decoded output are written; the
+ * whole of it outside --range.
+ */
+static uint64_t out_skip = 0;
+static uint64_t out_left = UINT64_MAX;
+
+static void emit_run(uint64_t n, char c) {
+    if (out_skip > 0) {
+        uint64_t skip = n < out_skip ? n : out_skip;
+        out_skip -= skip;
+        n -= skip;
+    }
+    n = n < out_left ? n : out_left;
+    out_left -= n;
+    io_fill(&out, c, n);
+}
+
+static void emit_literal(const char *data, uint64_t n) {
+    if (out_skip > 0) {
+        uint64_t skip = n < out_skip ? n : out_skip;
+        out_skip -= skip;
+        data += skip;
+        n -= skip;
+    }
+    n = n < out_left ? n : out_left;
+    out_left -= n;
+    io_write(&out, data, n);
+}
+
+/*
+ * Decoder state for one archive. A record, varint or literal block can
+ * straddle two input blocks when the archive is read through a pipe.
+ */
+enum _v2_state_ {
+    V2_TAG = 0,         /* reading a varint tag */
+    V2_RUN_CHAR,        /* tag was a run; its byte is next */
+    V2_LITERAL,         /* copying literal bytes */
+};
+
+typedef struct {
+    int format;         /* 0 until the first 4 bytes have been seen */
+    char partial[5];    /* format 1: bytes of an incomplete record */
+    size_t partial_len;
+    int state;          /* format 2 */
+    uint64_t tag;
+    int shift;
+    uint64_t remaining;
+    int corrupt;
+} decoder;
+
+/* Format 1: a sequence of 5-byte records, a 4-byte count and a byte */
+static void decode_v1(decoder *d, const char *data, size_t len) {
+    size_t i = 0;
+    uint32_t num_chars;
+
+    if (d->partial_len > 0) {
+        while (d->partial_len < 5 && i < len) {
+            d->partial[d->partial_len++] = data[i++];
+        }
+        if (d->partial_len < 5) {
+            return;
+        }
+        memcpy(&num_chars, d->partial, 4);
+        emit_run(num_chars, d->partial[4]);
+        d->partial_len = 0;
+    }
+    for (; i + 5 <= len; i += 5) {
+        memcpy(&num_chars, data + i, 4);
+        emit_run(num_chars, data[i + 4]);
+    }
+    while (i < len) {
+        d->partial[d->partial_len++] = data[i++];
+    }
+}
+
+/* Format 2: varint-tagged runs and literal blocks, see wzip.c */
+static void decode_v2(decoder *d, const char *data, size_t len) {
+    size_t i = 0;
+
+    while (i < len && !d->corrupt) {
+        switch (d->state) {
+            case V2_TAG: {
+                unsigned char b = data[i++];
+                if (d->shift > 63) {
+                    d->corrupt = 1;
+                    break;
+                }
+                d->tag |= (uint64_t) (b & 0x7f) << d->shift;
+                d->shift += 7;
+                if (b & 0x80) {
+                    break;
+                }
+                d->remaining = d->tag >> 1;
+                d->state = (d->tag & 1) ? V2_RUN_CHAR :
+                           d->remaining > 0 ? V2_LITERAL : V2_TAG;
+                d->tag = 0;
+                d->shift = 0;
+                break;
+            }
+            case V2_RUN_CHAR:
+                emit_run(d->remaining, data[i++]);
+                d->state = V2_TAG;
+                break;
+            default: {
+                size_t n = len - i < d->remaining ? len - i : d->remaining;
+                emit_literal(data + i, n);
+                i += n;
+                d->remaining -= n;
+                if (d->remaining == 0) {
+                    d->state = V2_TAG;
+                }
+                break;
+            }
+        }
+    }
+}
+
+static void decode(decoder *d, const char *data, size_t len) {
+    if (d->format == 0) {
+        /* Collect the first 4 bytes to tell the two formats apart */
+        size_t n = 4 - d->partial_len < len ? 4 - d->partial_len : len;
+        memcpy(d->partial + d->partial_len, data, n);
+        d->partial_len += n;
+        data += n;
+        len -= n;
+        if (d->partial_len < 4) {
+            return;
+        }
+        if (memcmp(d->partial, V2_MAGIC, 4) == 0) {
+            d->format = 2;
+            d->partial_len = 0;
+        } else {
+            d->format = 1;
+        }
+    }
+    if (d->format == 2) {
+        decode_v2(d, data, len);
+    } else {
+        decode_v1(d, data, len);
+    }
+}
+
+/*
+ * Expand every record of fd from byte start on, whichever format it is in;
+ * a nonzero start must be the offset of a format 1 record. Returns 0 on
+ * success, -1 on a read error, 1 if the archive is corrupt or truncated.
+ */
+static int unzip_fd(int fd, uint64_t start) {
+    io_reader r;
+    const char *data;
+    size_t len;
+    decoder d;
+    int ret = 0;
+
+    if (io_reader_open(&r, fd, 0) != 0) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
+    memset(&d, 0, sizeof(d));
+    d.format = start > 0 ? 1 : 0;
+    while (out_left > 0 && (ret = io_next_block(&r, &data, &len, 0)) > 0) {
+        /* A mapped file comes back whole, so skip to start here, not with lseek */
+        size_t skip = start < len ? start : len;
+        start -= skip;
+        decode(&d, data + skip, len - skip);
+    }
+    io_reader_close(&r);
+    if (out_left == 0) {
+        return 0;
+    }
+    if (ret == 0 && d.format == 2 &&
+        (d.corrupt || d.state != V2_TAG || d.shift != 0)) {
+        return 1;
+    }
+    return ret;
+}
+
+/*
+ * Find the sampled record at or before offset by binary-searching the index
+ * on disk. Sets *record and *pos to the record number and the uncompressed
+ * offset it starts at. Without a usable index, decoding starts at record 0;
+ * an index that does not describe an archive of num_records records (a
+ * stale one, say) is not usable.
+ */
+static void seek_index(const char *index_path, uint64_t num_records, uint64_t offset,
+                       uint64_t *record, uint64_t *pos) {
+    int index_fd = open(index_path, O_RDONLY);
+    struct stat st;
+    index_header hdr;
+
+    *record = 0;
+    *pos = 0;
+    if (index_fd < 0) {
+        return;
+    }
+
+    uint64_t num_entries = 0;
+    int ok = fstat(index_fd, &st) == 0 &&
+             pread(index_fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+             memcmp(hdr.magic, INDEX_MAGIC, 4) == 0 && hdr.interval != 0 &&
+             hdr.num_records == num_records;
+    if (ok) {
+        num_entries = (hdr.num_records + hdr.interval - 1) / hdr.interval;
+        ok = (uint64_t) st.st_size == sizeof(hdr) + num_entries * sizeof(uint64_t);
+    }
+    if (!ok) {
+        fprintf(stderr, "wunzip: ignoring malformed index '%s'\n", index_path);
+        close(index_fd);
+        return;
+    }
+
+    uint64_t lo = 0;
+    uint64_t hi = num_entries;
+    uint64_t lo_pos = 0;
+    while (hi - lo > 1) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        uint64_t entry;
+        if (pread(index_fd, &entry, sizeof(entry), sizeof(hdr) + mid * sizeof(entry)) !=
+                sizeof(entry) || entry > hdr.total_bytes) {
+            fprintf(stderr, "wunzip: ignoring malformed index '%s'\n", index_path);
+            close(index_fd);
+            return;
+        }
+        if (entry <= offset) {
+            lo = mid;
+            lo_pos = entry;
+        } else {
+            hi = mid;
+        }
+    }
+    *record = lo * hdr.interval;
+    *pos = lo_pos;
+    close(index_fd);
+}
+
+/* Write bytes [offset, offset + len) of the archive's uncompressed data */
+static int unzip_range(const char *path, const char *index_path,
+                       uint64_t offset, uint64_t len) {
+    struct stat st;
+    char magic[4];
+    uint64_t record;
+    uint64_t pos;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stdout, "wunzip: cannot open file\n");
+        return 1;
+    }
+
+    out_left = len;
+    if (pread(fd, magic, 4, 0) == 4 && memcmp(magic, V2_MAGIC, 4) == 0) {
+        /* Format 2 has no index; decode from the start and drop what is outside */
+        out_skip = offset;
+        int ret = unzip_fd(fd, 0);
+        close(fd);
+        return ret != 0;
+    }
+
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return 1;
+    }
+    seek_index(index_path, st.st_size / 5, offset, &record, &pos);
+    out_skip = offset - pos;
+    int ret = unzip_fd(fd, record * 5);
+    close(fd);
+    return ret != 0;
+}
 
 int main(int argc, char *argv[]) {
-    FILE *in_stream = NULL;
-    char line[5];
+    int ret = 0;
 
     if (argc <= 1) {
         fprintf(stdout, "wunzip: file1 [file2 ...]\n");
         exit(1);
     }
 
+    if (io_writer_open(&out, STDOUT_FILENO) != 0) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
+
+    if (strcmp(argv[1], "--range") == 0) {
+        char *end1;
+        char *end2;
+        char index_path[PATH_MAX];
+
+        if (argc != 5 && argc != 6) {
+            fprintf(stdout, "wunzip: --range OFFSET LEN file [index]\n");
+            exit(1);
+        }
+        uint64_t offset = strtoull(argv[2], &end1, 10);
+        uint64_t len = strtoull(argv[3], &end2, 10);
+        if (*argv[2] == '\0' || *end1 != '\0' || *argv[3] == '\0' || *end2 != '\0') {
+            fprintf(stdout, "wunzip: --range OFFSET LEN file [index]\n");
+            exit(1);
+        }
+        if (argc == 6) {
+            snprintf(index_path, sizeof(index_path), "%s", argv[5]);
+        } else {
+            snprintf(index_path, sizeof(index_path), "%s.idx", argv[4]);
+        }
+        ret = unzip_range(argv[4], index_path, offset, len);
+        io_writer_close(&out);
+        return ret;
+    }
+
+    prefetcher *pf = prefetch_start(argv + 1, argc - 1);
+    if (pf == NULL) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
+
     for (uint32_t i = 1; i < argc; i++) {
-        in_stream = fopen(argv[i], "r");
-        if (in_stream == NULL) {
+        int fd = prefetch_next(pf);
+        if (fd < 0) {
+            io_flush(&out);
             fprintf(stdout, "wcat: cannot open file\n");
             exit(1);
         }
-
-        while (fread(line, 5, 1, in_stream)) {
-            uint32_t num_chars = *((uint32_t *) line);
-            char char_to_print = line[4];
-            for(uint32_t i = 0; i < num_chars; i++) {
-                fprintf(stdout, "%c", char_to_print);
-            }
+        int err = unzip_fd(fd, 0);
+        if (err != 0) {
+            fprintf(stderr, err < 0 ? "wunzip: read failed\n" :
+                                      "wunzip: corrupt archive\n");
+            ret = 1;
         }
+        close(fd);
+    }
+    prefetch_stop(pf);
+    if (io_writer_close(&out) != 0) {
+        ret = 1;
     }
 
-    return 0;
-}
\ No newline at end of file
+    return ret;
+}
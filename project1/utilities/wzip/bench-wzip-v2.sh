@@ -0,0 +1,53 @@
+#! /bin/bash
+
+# usage: bench-wzip-v2.sh [size-in-MB]
+#
+# Compares format 1 (default) and format 2 (-2) on text, binary and sparse
+# inputs of the given size: compressed size relative to the input, and
+# wzip and wunzip throughput.
+
+if ! [[ -x wzip && -x ../wunzip/wunzip ]]; then
+    echo "build wzip and ../wunzip/wunzip first"
+    exit 1
+fi
+
+size_mb=${1:-64}
+bytes=$((size_mb * 1024 * 1024))
+benchdir=$(mktemp -d)
+trap 'rm -rf $benchdir' EXIT
+
+# text: the C sources of this repository, repeated
+while [[ $(stat -c %s $benchdir/text 2>/dev/null || echo 0) -lt $bytes ]]; do
+    find ../.. -name '*.c' -exec cat {} + >> $benchdir/text
+done
+truncate -s $bytes $benchdir/text
+# binary: incompressible
+head -c $bytes /dev/urandom > $benchdir/binary
+# sparse: 4 KB blocks, each zero except for 64 random bytes
+python3 -c "
+import os, sys
+out = sys.stdout.buffer
+for _ in range($bytes // 4096):
+    out.write(bytes(4032) + os.urandom(64))
+" > $benchdir/sparse
+
+# elapsed_ns command... (stdout discarded)
+elapsed_ns () {
+    local start=$(date +%s%N)
+    eval "$@" > /dev/null
+    echo $(($(date +%s%N) - start))
+}
+
+printf "%-8s %-6s %9s %12s %12s\n" input format ratio "zip GB/s" "unzip GB/s"
+for input in text binary sparse; do
+    for format in 1 2; do
+        flag=$([[ $format == 2 ]] && echo -2)
+        zip_ns=$(elapsed_ns ./wzip $flag $benchdir/$input)
+        ./wzip $flag $benchdir/$input > $benchdir/archive
+        unzip_ns=$(elapsed_ns ../wunzip/wunzip $benchdir/archive)
+        awk -v input=$input -v format=v$format -v bytes=$bytes \
+            -v zbytes=$(stat -c %s $benchdir/archive) -v zns=$zip_ns -v uns=$unzip_ns \
+            'BEGIN { printf "%-8s %-6s %8.3fx %12.3f %12.3f\n", input, format,
+                     zbytes / bytes, bytes / zns, bytes / uns }'
+    done
+done
@@ -0,0 +1,37 @@
+#! /bin/bash
+
+# usage: bench-wzip.sh [size-in-MB] [extra wzip args, e.g. -j 4]
+#
+# Generates a low-entropy and a high-entropy input of the given size and
+# reports wzip throughput on each, once through mmap (file argument) and
+# once through the read() fallback (pipe on stdin).
+
+if ! [[ -x wzip ]]; then
+    echo "wzip executable does not exist"
+    exit 1
+fi
+
+size_mb=${1:-256}
+shift
+benchdir=$(mktemp -d)
+trap 'rm -rf $benchdir' EXIT
+
+yes aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaabbbbbbbbbbbbbbbbcccccccc | \
+    head -c $((size_mb * 1024 * 1024)) > $benchdir/low
+head -c $((size_mb * 1024 * 1024)) /dev/urandom > $benchdir/high
+
+# run_bench name command...
+run_bench () {
+    local name=$1
+    shift
+    local start=$(date +%s%N)
+    eval "$@" > /dev/null
+    local end=$(date +%s%N)
+    awk -v name="$name" -v bytes=$((size_mb * 1024 * 1024)) -v ns=$((end - start)) \
+        'BEGIN { printf "%-14s %8.3f s %8.3f GB/s\n", name, ns / 1e9, bytes / ns }'
+}
+
+for input in low high; do
+    run_bench "$input (mmap)" ./wzip $* $benchdir/$input
+    run_bench "$input (pipe)" "cat $benchdir/$input | ./wzip $* /dev/stdin"
+done
@@ -5,62 +5,585 @@
 #include <stdint.h>
 #include <errno.h>
 #include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "../common/fastio.h"
+#include "../common/prefetch.h"
 
-int main(int argc, char *argv[]) {
-    FILE *in_stream = NULL;
-    char curr_char;
-    char prev_char;
-    uint32_t num_char = 0;
-    uint32_t unread_files = argc - 1;
-    uint32_t curr_file;
-
-    if (unread_files == 0) {
-        fprintf(stdout, "wzip: file1 [file2 ...]\n");
+/* Bytes of the concatenated input handed to one worker per round */
+#define CHUNK_SIZE (1 << 20)
+#define MAX_THREADS 256
+/* Records between two samples of the index written by -x */
+#define INDEX_INTERVAL 4096
+#define INDEX_MAGIC "WZI1"
+/*
+ * Format 2 (-2) starts with this magic (must match wunzip.c), followed by
+ * blocks that each begin with a LEB128 varint tag. A tag of (n << 1) | 1
+ * is a run of n copies of the byte that follows; (n << 1) | 0 is n literal
+ * bytes copied verbatim. Runs shorter than V2_MIN_RUN go into literals.
+ */
+#define V2_MAGIC "\x89WZ2"
+#define V2_MIN_RUN 3
+#define V2_LITERAL_MAX (64 << 10)
+
+typedef struct {
+    int fd;
+    off_t start;    /* offset of this file in the concatenated input */
+    off_t size;
+} input_file;
+
+typedef struct {
+    uint32_t count;
+    char c;
+} run;
+
+/*
+ * Header of the index sidecar (must match wunzip.c). It is followed by
+ * ceil(num_records / interval) uint64 entries; entry i is the uncompressed
+ * offset at which record i * interval starts.
+ */
+typedef struct {
+    char magic[4];
+    uint32_t interval;
+    uint64_t num_records;
+    uint64_t total_bytes;
+} index_header;
+
+typedef struct {
+    off_t start;    /* range of the concatenated input to encode */
+    off_t end;
+    char *buf;
+    run *runs;
+    uint32_t num_runs;
+    int error;
+} chunk;
+
+typedef struct {
+    input_file *files;
+    uint32_t num_files;
+    chunk *chunks;
+    uint32_t num_threads;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_cv;
+    pthread_cond_t done_cv;
+    uint64_t round;         /* bumped by main to start a round */
+    uint32_t num_done;      /* workers finished with the current round */
+    int quit;
+} pool;
+
+typedef struct {
+    pool *p;
+    uint32_t id;
+} worker_arg;
+
+/* Output records are coalesced into large writes */
+static io_writer out;
+
+/* Prefix sums of run lengths, sampled every INDEX_INTERVAL records */
+static FILE *index_stream = NULL;
+static uint64_t *index_entries = NULL;
+static uint64_t index_cap = 0;
+static uint64_t num_records = 0;
+static uint64_t total_bytes = 0;
+
+static void index_run(uint32_t num_char) {
+    if (num_records % INDEX_INTERVAL == 0) {
+        uint64_t n = num_records / INDEX_INTERVAL;
+        if (n == index_cap) {
+            index_cap = index_cap ? 2 * index_cap : 1024;
+            index_entries = realloc(index_entries, index_cap * sizeof(uint64_t));
+            if (index_entries == NULL) {
+                fprintf(stderr, "malloc failed\n");
+                exit(1);
+            }
+        }
+        index_entries[n] = total_bytes;
+    }
+    num_records++;
+    total_bytes += num_char;
+}
+
+static int write_index(void) {
+    index_header hdr;
+    uint64_t n = (num_records + INDEX_INTERVAL - 1) / INDEX_INTERVAL;
+
+    memcpy(hdr.magic, INDEX_MAGIC, 4);
+    hdr.interval = INDEX_INTERVAL;
+    hdr.num_records = num_records;
+    hdr.total_bytes = total_bytes;
+    if (fwrite(&hdr, sizeof(hdr), 1, index_stream) != 1 ||
+        fwrite(index_entries, sizeof(uint64_t), n, index_stream) != n) {
+        return -1;
+    }
+    return fclose(index_stream);
+}
+
+/* Format 2 state: literal bytes not yet written, waiting for their tag */
+static int format = 1;
+static char literal[V2_LITERAL_MAX];
+static size_t literal_len = 0;
+
+static void write_tag(uint64_t tag) {
+    char buf[10];
+    size_t n = 0;
+
+    while (tag >= 0x80) {
+        buf[n++] = (char) (tag | 0x80);
+        tag >>= 7;
+    }
+    buf[n++] = (char) tag;
+    memcpy(io_reserve(&out, n), buf, n);
+}
+
+static void flush_literal(void) {
+    if (literal_len > 0) {
+        write_tag((uint64_t) literal_len << 1);
+        io_write(&out, literal, literal_len);
+        literal_len = 0;
+    }
+}
+
+static void write_run_v2(uint32_t num_char, char c) {
+    if (num_char == 0) {
+        return;
+    }
+    if (num_char >= V2_MIN_RUN) {
+        flush_literal();
+        write_tag(((uint64_t) num_char << 1) | 1);
+        *io_reserve(&out, 1) = c;
+        return;
+    }
+    if (literal_len + num_char > V2_LITERAL_MAX) {
+        flush_literal();
+    }
+    /* Below V2_MIN_RUN, so one or two bytes */
+    literal[literal_len++] = c;
+    if (num_char == 2) {
+        literal[literal_len++] = c;
+    }
+}
+
+static void write_run(uint32_t num_char, char c) {
+    if (format == 2) {
+        write_run_v2(num_char, c);
+        return;
+    }
+    if (index_stream != NULL) {
+        index_run(num_char);
+    }
+    char *record = io_reserve(&out, 5);
+    memcpy(record, &num_char, 4);
+    record[4] = c;
+}
+
+/*
+ * Return the number of leading bytes of buf[0..len) equal to c. Long spans
+ * of identical bytes are skipped 16 bytes (SSE2) or 8 bytes (word compare)
+ * at a time.
+ */
+static size_t run_length(const unsigned char *buf, size_t len, unsigned char c) {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    __m128i pattern16 = _mm_set1_epi8((char) c);
+    while (i + 16 <= len) {
+        __m128i block = _mm_loadu_si128((const __m128i *) (buf + i));
+        uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, pattern16));
+        if (mask != 0xffff) {
+            return i + __builtin_ctz(~mask);
+        }
+        i += 16;
+    }
+#endif
+
+    uint64_t pattern = 0x0101010101010101ULL * c;
+    while (i + 8 <= len) {
+        uint64_t word;
+        memcpy(&word, buf + i, 8);
+        uint64_t diff = word ^ pattern;
+        if (diff != 0) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            return i + (__builtin_ctzll(diff) >> 3);
+#else
+            return i + (__builtin_clzll(diff) >> 3);
+#endif
+        }
+        i += 8;
+    }
+
+    while (i < len && buf[i] == c) {
+        i++;
+    }
+    return i;
+}
+
+/* Append n copies of c to the open run, writing out every run that closes */
+static void add_run(run *pending, char c, uint64_t n) {
+    if (pending->count > 0 && pending->c != c) {
+        write_run(pending->count, pending->c);
+        pending->count = 0;
+    }
+    pending->c = c;
+    while (n > UINT32_MAX - pending->count) {
+        /* Split runs that do not fit in a 32-bit count */
+        n -= UINT32_MAX - pending->count;
+        write_run(UINT32_MAX, c);
+        pending->count = 0;
+    }
+    pending->count += n;
+}
+
+/* Fold buf into the open run, writing out every run that closes */
+static void zip_buffer(run *pending, const unsigned char *buf, size_t len) {
+    size_t i = 0;
+
+    while (i < len) {
+        /* Short runs dominate high-entropy input; skip the scanner for them */
+        size_t n = 1;
+        if (i + 1 < len && buf[i+1] == buf[i]) {
+            n = run_length(buf + i, len - i, buf[i]);
+        }
+        add_run(pending, buf[i], n);
+        i += n;
+    }
+}
+
+/*
+ * Feed one input file through zip_buffer(). Regular files are mapped and
+ * scanned in place; anything that cannot be mapped (pipes, ttys, empty
+ * files) is read through an aligned buffer instead.
+ */
+static int zip_file(int fd, run *pending) {
+    io_reader r;
+    const char *data;
+    size_t len;
+    int ret;
+
+    if (io_reader_open(&r, fd, 0) != 0) {
+        fprintf(stderr, "malloc failed\n");
         exit(1);
     }
+    while ((ret = io_next_block(&r, &data, &len, 0)) > 0) {
+        zip_buffer(pending, (const unsigned char *) data, len);
+    }
+    io_reader_close(&r);
+    return ret;
+}
 
-    curr_file = 1;
-    in_stream = fopen(argv[curr_file], "r");
-    unread_files--;
-    if (in_stream == NULL) {
-        fprintf(stdout, "wcat: cannot open file\n");
+static int serial_zip(int argc, char *argv[]) {
+    run pending = {0, 0};
+    prefetcher *pf = prefetch_start(argv + 1, argc - 1);
+
+    if (pf == NULL) {
+        fprintf(stderr, "malloc failed\n");
         exit(1);
     }
 
-    while(1) {
-        if (fread(&curr_char, 1, 1, in_stream) != 1) {
-            if (unread_files > 0) {
-                fclose(in_stream);
-                curr_file++;
-                unread_files--;
-                in_stream = fopen(argv[curr_file], "r");
+    for (uint32_t i = 1; i < argc; i++) {
+        int fd = prefetch_next(pf);
+        if (fd < 0) {
+            io_flush(&out);
+            fprintf(stdout, "wcat: cannot open file\n");
+            exit(1);
+        }
+        if (zip_file(fd, &pending) != 0) {
+            fprintf(stderr, "wzip: read failed\n");
+            close(fd);
+            prefetch_stop(pf);
+            return 1;
+        }
+        close(fd);
+    }
+    prefetch_stop(pf);
+
+    /* End of all files. Print the last consecutive charcters */
+    write_run(pending.count, pending.c);
+    return 0;
+}
+
+/* Copy [start, end) of the concatenated input into buf. Returns 0 on success */
+static int read_range(input_file *files, uint32_t num_files,
+                      off_t start, off_t end, char *buf) {
+    for (uint32_t i = 0; i < num_files && start < end; i++) {
+        off_t file_end = files[i].start + files[i].size;
+        if (file_end <= start) {
+            continue;
+        }
+
+        off_t pos = start - files[i].start;
+        off_t len = (end < file_end ? end : file_end) - start;
+        while (len > 0) {
+            ssize_t nread = pread(files[i].fd, buf, len, pos);
+            if (nread <= 0) {
+                if (nread < 0 && errno == EINTR) {
+                    continue;
+                }
+                return -1;
+            }
+            buf += nread;
+            pos += nread;
+            start += nread;
+            len -= nread;
+        }
+    }
+    return 0;
+}
+
+static void encode_chunk(chunk *c) {
+    const unsigned char *buf = (unsigned char *) c->buf;
+    size_t len = c->end - c->start;
+    size_t i = 0;
+    uint32_t n = 0;
+
+    while (i < len) {
+        size_t count = 1;
+        if (i + 1 < len && buf[i+1] == buf[i]) {
+            count = run_length(buf + i, len - i, buf[i]);
+        }
+        c->runs[n].count = count;
+        c->runs[n].c = buf[i];
+        n++;
+        i += count;
+    }
+    c->num_runs = n;
+}
+
+static void *worker(void *arg) {
+    pool *p = ((worker_arg *) arg)->p;
+    chunk *c = &p->chunks[((worker_arg *) arg)->id];
+    uint64_t seen_round = 0;
+
+    while (1) {
+        pthread_mutex_lock(&p->lock);
+        while (p->round == seen_round && !p->quit) {
+            pthread_cond_wait(&p->work_cv, &p->lock);
+        }
+        if (p->quit) {
+            pthread_mutex_unlock(&p->lock);
+            break;
+        }
+        seen_round = p->round;
+        pthread_mutex_unlock(&p->lock);
+
+        c->num_runs = 0;
+        c->error = 0;
+        if (c->start < c->end) {
+            if (read_range(p->files, p->num_files, c->start, c->end, c->buf) != 0) {
+                c->error = 1;
             } else {
-                /* End of all files. Print the last consecutive charcters */
-                fclose(in_stream);
-                fwrite(&num_char, 4, 1, stdout);
-                fwrite(&prev_char, 1, 1, stdout);
+                encode_chunk(c);
+            }
+        }
+
+        pthread_mutex_lock(&p->lock);
+        p->num_done++;
+        pthread_cond_signal(&p->done_cv);
+        pthread_mutex_unlock(&p->lock);
+    }
+    return NULL;
+}
+
+/*
+ * Encode the concatenated input in rounds of num_threads chunks. Workers
+ * encode their chunk independently; the main thread then stitches the runs
+ * that straddle chunk (and therefore file) boundaries and writes them out in
+ * order, so the output is identical to serial_zip().
+ */
+static int parallel_zip(input_file *files, uint32_t num_files, off_t total,
+                        uint32_t num_threads) {
+    pool p;
+    pthread_t tids[MAX_THREADS];
+    worker_arg args[MAX_THREADS];
+    run pending = {0, 0};
+    int ret = 0;
+
+    memset(&p, 0, sizeof(p));
+    p.files = files;
+    p.num_files = num_files;
+    p.num_threads = num_threads;
+    p.chunks = calloc(num_threads, sizeof(chunk));
+    if (p.chunks == NULL) {
+        fprintf(stderr, "malloc failed\n");
+        return 1;
+    }
+    for (uint32_t i = 0; i < num_threads; i++) {
+        p.chunks[i].buf = io_alloc(CHUNK_SIZE);
+        p.chunks[i].runs = malloc(CHUNK_SIZE * sizeof(run));
+        if (p.chunks[i].buf == NULL || p.chunks[i].runs == NULL) {
+            fprintf(stderr, "malloc failed\n");
+            exit(1);
+        }
+    }
+    pthread_mutex_init(&p.lock, NULL);
+    pthread_cond_init(&p.work_cv, NULL);
+    pthread_cond_init(&p.done_cv, NULL);
+
+    for (uint32_t i = 0; i < num_threads; i++) {
+        args[i].p = &p;
+        args[i].id = i;
+        pthread_create(&tids[i], NULL, worker, &args[i]);
+    }
+
+    off_t next = 0;
+    while (next < total && ret == 0) {
+        for (uint32_t i = 0; i < num_threads; i++) {
+            off_t end = next + CHUNK_SIZE;
+            p.chunks[i].start = next;
+            p.chunks[i].end = end < total ? end : total;
+            next = p.chunks[i].end;
+        }
+
+        pthread_mutex_lock(&p.lock);
+        p.num_done = 0;
+        p.round++;
+        pthread_cond_broadcast(&p.work_cv);
+        while (p.num_done < num_threads) {
+            pthread_cond_wait(&p.done_cv, &p.lock);
+        }
+        pthread_mutex_unlock(&p.lock);
+
+        for (uint32_t i = 0; i < num_threads; i++) {
+            chunk *c = &p.chunks[i];
+            if (c->error) {
+                fprintf(stderr, "wzip: read failed\n");
+                ret = 1;
                 break;
             }
-        } else {
-            if (num_char == 0) {
-                /* First char read. Initialize everything */
-                num_char = 1;
-                prev_char = curr_char;
-            } else {
-                if (curr_char == prev_char) {
-                    num_char++;
-                } else {
-                    /*Print current consecutive chararacters and reset variables */
-                    fwrite(&num_char, 4, 1, stdout);
-                    fwrite(&prev_char, 1, 1, stdout);
-                    prev_char = curr_char;
-                    num_char = 1;
-                }
+            for (uint32_t r = 0; r < c->num_runs; r++) {
+                add_run(&pending, c->runs[r].c, c->runs[r].count);
             }
         }
     }
-    return 0;
-}
\ No newline at end of file
+    if (ret == 0) {
+        write_run(pending.count, pending.c);
+    }
+
+    pthread_mutex_lock(&p.lock);
+    p.quit = 1;
+    pthread_cond_broadcast(&p.work_cv);
+    pthread_mutex_unlock(&p.lock);
+    for (uint32_t i = 0; i < num_threads; i++) {
+        pthread_join(tids[i], NULL);
+        free(p.chunks[i].buf);
+        free(p.chunks[i].runs);
+    }
+    free(p.chunks);
+    pthread_mutex_destroy(&p.lock);
+    pthread_cond_destroy(&p.work_cv);
+    pthread_cond_destroy(&p.done_cv);
+    return ret;
+}
+
+static int zip_inputs(int argc, char *argv[], uint32_t num_threads) {
+    if (num_threads == 0) {
+        return serial_zip(argc, argv);
+    }
+
+    /*
+     * Parallel mode needs random access to every input. If any argument is
+     * not a regular file (e.g. a pipe), fall back to the streaming encoder.
+     */
+    uint32_t num_files = argc - 1;
+    input_file *files = calloc(num_files, sizeof(input_file));
+    off_t total = 0;
+    if (files == NULL) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < num_files; i++) {
+        struct stat st;
+        files[i].fd = open(argv[i+1], O_RDONLY);
+        if (files[i].fd < 0) {
+            fprintf(stdout, "wcat: cannot open file\n");
+            exit(1);
+        }
+        if (fstat(files[i].fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+            for (uint32_t j = 0; j <= i; j++) {
+                close(files[j].fd);
+            }
+            free(files);
+            return serial_zip(argc, argv);
+        }
+        files[i].start = total;
+        files[i].size = st.st_size;
+        total += st.st_size;
+    }
+
+    int ret = parallel_zip(files, num_files, total, num_threads);
+    for (uint32_t i = 0; i < num_files; i++) {
+        close(files[i].fd);
+    }
+    free(files);
+    return ret;
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t num_threads = 0;
+    int opt;
+    int ret;
+
+    while ((opt = getopt(argc, argv, "+j:x:2")) != -1) {
+        switch (opt) {
+            case 'j':
+                num_threads = atoi(optarg);
+                if (num_threads < 1 || num_threads > MAX_THREADS) {
+                    fprintf(stdout, "wzip: -j must be between 1 and %d\n", MAX_THREADS);
+                    exit(1);
+                }
+                break;
+            case 'x':
+                index_stream = fopen(optarg, "w");
+                if (index_stream == NULL) {
+                    fprintf(stdout, "wzip: cannot open index file\n");
+                    exit(1);
+                }
+                break;
+            case '2':
+                format = 2;
+                break;
+            default:
+                fprintf(stdout, "wzip: [-j threads] [-x index | -2] file1 [file2 ...]\n");
+                exit(1);
+        }
+    }
+    argv[optind - 1] = argv[0];
+    argv += optind - 1;
+    argc -= optind - 1;
+
+    if (argc <= 1) {
+        fprintf(stdout, "wzip: file1 [file2 ...]\n");
+        exit(1);
+    }
+    /* The index addresses fixed-size format 1 records */
+    if (format == 2 && index_stream != NULL) {
+        fprintf(stdout, "wzip: -x cannot be combined with -2\n");
+        exit(1);
+    }
+
+    if (io_writer_open(&out, STDOUT_FILENO) != 0) {
+        fprintf(stderr, "malloc failed\n");
+        exit(1);
+    }
+    if (format == 2) {
+        io_write(&out, V2_MAGIC, 4);
+    }
+    ret = zip_inputs(argc, argv, num_threads);
+    if (format == 2) {
+        flush_literal();
+    }
+    if (io_writer_close(&out) != 0) {
+        ret = 1;
+    }
+    if (ret == 0 && index_stream != NULL && write_index() != 0) {
+        fprintf(stderr, "wzip: cannot write index file\n");
+        ret = 1;
+    }
+    return ret;
+}
@@ -0,0 +1,31 @@
+#! /bin/bash
+
+# usage: bench-launch.sh [commands]
+#
+# Runs a batch file of short commands (default 5000) through wish once
+# with posix_spawn and once with fork+execv (WISH_LAUNCH=fork), and
+# reports commands per second for each. Half the lines are a single
+# command and half are four parallel commands, one of them redirected.
+
+if ! [[ -x wish ]]; then
+    echo "wish executable does not exist"
+    exit 1
+fi
+
+commands=${1:-5000}
+benchdir=$(mktemp -d)
+trap 'rm -rf $benchdir' EXIT
+
+echo "path /bin /usr/bin" > $benchdir/batch
+for ((i = 0; i < commands / 5; i++)); do
+    echo "true"
+    echo "true & true & true & true > $benchdir/out"
+done >> $benchdir/batch
+
+for mode in spawn fork; do
+    start=$(date +%s%N)
+    WISH_LAUNCH=$mode ./wish $benchdir/batch
+    end=$(date +%s%N)
+    awk -v mode=$mode -v n=$commands -v ns=$((end - start)) \
+        'BEGIN { printf "%-6s %8d commands %8.3f s %10.0f commands/s\n", mode, n, ns / 1e9, n / (ns / 1e9) }'
+done
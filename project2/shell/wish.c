@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -11,10 +12,27 @@
 #include <stdbool.h>
 #include <fcntl.h>
 #include <sys/wait.h>
+#include <limits.h>
+#include <spawn.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/resource.h>
 
 /* DEFINES */
 #define INTERACTIVE_MODE 1
 #define BATCH_MODE       2
+#define HASH_BUCKETS     256
+
+/* Compiled batch scripts, see CompileScript() */
+#define COMPILED_MAGIC   "WSC2"
+#define COMPILED_SUFFIX  ".wishc"
+#define COMPILED_ERROR   UINT32_MAX    // command count of a line with a syntax error
+#define COMPILED_PIPE    1             // command flags
+#define COMPILED_REDIRECT 2
+
+/* How external commands are started; WISH_LAUNCH=fork selects fork+execv */
+#define LAUNCH_SPAWN     1
+#define LAUNCH_FORK      2
 
 typedef struct _node_ {
     void *data;
@@ -27,25 +45,171 @@ typedef struct _linkedlist_ {
     int count;
 }linkedlist;
 
+/* Tokens point into the input line, which the parser splits in place */
 typedef struct {
-    linkedlist argv;   // List of all tokens for this command
-    linkedlist redirection;
+    char **argv;       // NULL terminated, slice of the line's token array
+    int argc;
+    char *redirect;    // output file of '>', or NULL
+    bool pipe_next;    // stdout feeds the stdin of the next command in the list
+    pid_t pid;         // set once launched, -1 if it could not be or has exited
+    double started;    // first stage of a pipeline: launch time, in seconds
+    double elapsed;    // first stage of a pipeline: wall time once it is done
 } command;
 
+typedef struct {
+    command *cmds;
+    int count;
+    bool background;   // the line ends in '&'
+    unsigned int line_number;   // in the script, for the profile
+} command_list;
+
+/* A background line. Its children are reaped as they exit */
+typedef struct {
+    int id;
+    pid_t *pids;       // reaped children are set to -1
+    int num_pids;
+    int running;
+    char *cmdline;     // for `jobs`
+} job;
+
+/* Bump allocator for everything a parsed line needs, reset once per line */
+typedef struct {
+    char *base;
+    size_t size;
+    size_t used;
+} arena;
+
+/* Where Run() gets its lines: the input stream, or a compiled script */
+typedef struct {
+    FILE *fp;
+    char *line;        // getline() buffer, split in place by the parser
+    size_t line_cap;
+    char *compiled;    // whole compiled script, or NULL to parse each line
+    size_t compiled_size;
+    size_t pos;        // offset of the next line record in compiled
+    const char *cache_path;     // file compiled was loaded from
+    unsigned int line_number;   // of the last line read from fp or compiled
+} input_source;
+
+/* Start of a compiled script. The script's size and mtime tell whether the
+   cache is stale; the line records follow */
+typedef struct {
+    char magic[4];
+    uint32_t num_lines;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t script_size;
+    uint64_t data_size;
+} compiled_header;
+
+/* Growable byte buffer a script is compiled into */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} byte_buffer;
+
+/* One external command, for the WISH_PROFILE trace */
+typedef struct {
+    unsigned int line_number;
+    pid_t pid;
+    char *cmdline;
+    double started;        // seconds since the shell started
+    double exec_latency;   // from launching to the child's execv()
+    double wall;           // from launching to reaping
+    int status;            // exit code, or 128 + signal
+    bool done;
+    struct rusage usage;
+} profile_record;
+
+/* Cached location of an external command, like bash's `hash` */
+typedef struct _hash_entry_ {
+    char *name;
+    char *path;
+    dev_t dev;         // identity of the binary when it was found
+    ino_t ino;
+    struct _hash_entry_ *next;
+} hash_entry;
+
 static void InitList(linkedlist *list);
 static void InsertList(linkedlist *list, void *data);
 static void *PopList(linkedlist *list);
 static void ResetPath(linkedlist *path);
-static void ParseCommandList(linkedlist *cmd_list, char *line);
-static void DeleteCommand(command *cmd);
-static void ResetCommandList(linkedlist *cmd_list_ptr);
+static void ArenaReset(arena *a, size_t min_size);
+static void *ArenaAlloc(arena *a, size_t size);
+static bool ParseCommandList(command_list *cmd_list, char *line, arena *a);
+static void BufferPut(byte_buffer *buf, const void *data, size_t len);
+static bool CompileScript(FILE *fp, const struct stat *st, const char *cache_path,
+                          input_source *src);
+static bool LoadCompiledScript(const struct stat *st, const char *cache_path,
+                               input_source *src);
+static const void *TakeCompiled(input_source *src, size_t len);
+static const char *TakeCompiledString(input_source *src);
+static int NextCompiledLine(input_source *src, command_list *cmd_list, arena *a);
+static bool NextCommandList(input_source *src, command_list *cmd_list, arena *a);
 static void Run(int mode, char *file_path);
+static unsigned int HashName(const char *name);
+static void ClearHash(void);
+static const char *LookupCommand(linkedlist *path, const char *name);
+static void HashBuiltin(int argc, char **argv);
+static pid_t LaunchCommand(const char *cmd_path, char **argv, int in_fd, int out_fd,
+                           const char *redirect_file, double *exec_latency);
+static void SigchldHandler(int sig);
+static void AddJob(command_list *cmds, bool report);
+static void ChildExited(pid_t pid);
+static void RemoveDoneJobs(bool report);
+static void ReapJobs(bool report);
+static int WaitJobs(int id);
+static void JobsBuiltin(void);
+static double Now(void);
+static int StartPipeline(command_list *cmds, int first, linkedlist *path);
+static bool PipelineRunning(command_list *cmds, int first);
+static void RunCommandList(command_list *cmds, linkedlist *path, bool report);
+static void ParallelBuiltin(int argc, char **argv);
+static pid_t WaitChild(pid_t pid, int options);
+static void ProfileLaunched(command *cmd, unsigned int line_number, double started,
+                            double exec_latency);
+static void WriteProfile(void);
 
 /* GLOBAL VARIABLES */
 const char error_message[30] = "An error has occurred\n";
+static hash_entry *cmd_hash[HASH_BUCKETS];
+static bool hash_revalidate = false;   // stat cached binaries before each use
+static int launch_mode = LAUNCH_SPAWN;
+static job *jobs = NULL;
+static int num_jobs = 0;
+static int jobs_cap = 0;
+static int next_job_id = 1;
+static volatile sig_atomic_t child_exited = 0;   // set by SIGCHLD
+static int parallel_limit = 0;          // pipelines of a line run at once, 0 for no limit
+static bool parallel_timing = false;    // report wall times after each line
+static bool compile_scripts = false;    // WISH_COMPILE=1: run batch files from a compiled cache
+static char *profile_path = NULL;       // WISH_PROFILE=FILE: trace every external command
+static double profile_start;
+static profile_record *profile = NULL;
+static size_t profile_len = 0;
+static size_t profile_cap = 0;
 
 /* CODE */
 int main(int argc, char *argv[]) {
+    char *launch = getenv("WISH_LAUNCH");
+    if (launch != NULL && strcmp(launch, "fork") == 0) {
+        launch_mode = LAUNCH_FORK;
+    }
+    char *compile = getenv("WISH_COMPILE");
+    if (compile != NULL && strcmp(compile, "1") == 0) {
+        compile_scripts = true;
+    }
+    profile_path = getenv("WISH_PROFILE");
+    if (profile_path != NULL && profile_path[0] == '\0') {
+        profile_path = NULL;
+    }
+    profile_start = Now();
+    char *parallel = getenv("WISH_PARALLEL");
+    if (parallel != NULL && atoi(parallel) > 0) {
+        parallel_limit = atoi(parallel);
+    }
+
     if (argc == INTERACTIVE_MODE) {
         Run(INTERACTIVE_MODE, NULL);
     } else if (argc == BATCH_MODE) {
@@ -111,164 +275,1043 @@ static void ResetPath(linkedlist *path) {
     }
 }
 
-/* Initializes command by parsing input line and putting it in cmd_list.
-   If len(linkedlist) > 1, then it is a parallel command.
-   Error check here.
+/* Empties the arena, growing it first if it holds fewer than min_size bytes */
+static void ArenaReset(arena *a, size_t min_size) {
+    if (a->size < min_size) {
+        free(a->base);
+        a->size = min_size > 2 * a->size ? min_size : 2 * a->size;
+        a->base = (char *) malloc(a->size);
+        if (a->base == NULL) {
+            while(1);
+        }
+    }
+    a->used = 0;
+}
+
+static void *ArenaAlloc(arena *a, size_t size) {
+    size_t start = (a->used + 15) & ~(size_t) 15;
+    assert(start + size <= a->size);
+    a->used = start + size;
+    return a->base + start;
+}
+
+/* Initializes cmd_list by parsing the input line in a single pass. Commands
+   are separated by '&' or newline; a command's pipeline stages by '|', and
+   all but the last stage have pipe_next set. Tokens are split in place, so
+   parsing allocates nothing beyond one reset of the arena.
+   Error check here: on a syntax error the list is left empty and false is
+   returned; the caller reports it.
 */
+static bool ParseCommandList(command_list *cmd_list, char *line, arena *a) {
+    size_t len = strlen(line);
 
-static void ParseCommandList(linkedlist *cmd_list, char *line) {
-    char *line_copy = line;
-    char *parallel_sep_ptr, *whitespace_sep_ptr, *redirection_sep_ptr;
-    command *new_cmd;
-
-    /* First separate based on '&' and newline */
-    while ((parallel_sep_ptr = strsep(&line_copy, "&\n")) != NULL) {
-        if (*parallel_sep_ptr != '\0') {
-            new_cmd = (command *) malloc(sizeof(command));
-            InitList(&new_cmd->argv);
-            InitList(&new_cmd->redirection);
-            /* Then parse based on redirection if any */
-            int redirection_i = 0;
-            if (strstr(parallel_sep_ptr, ">") != NULL) {
-                while ((redirection_sep_ptr = strsep(&parallel_sep_ptr, ">")) != NULL) {
-                    if (*redirection_sep_ptr != '\0') {
-                        /* Finally parse on whitespaces */
-                        while ((whitespace_sep_ptr = strsep(&redirection_sep_ptr, " \t")) != NULL) {
-                            if (*whitespace_sep_ptr != '\0') {
-                                char *temp_ptr = strdup(whitespace_sep_ptr);
-                                if (temp_ptr == NULL) {
-                                    while(1);
-                                }
-                                if (redirection_i == 0) {
-                                    InsertList(&new_cmd->argv, temp_ptr);
-                                } else {
-                                    InsertList(&new_cmd->redirection, temp_ptr);
-                                }
-                            }
-                        }
-                        redirection_i++;
-                    }
-                }
+    /* A token takes at least two bytes (itself and a delimiter), so a line
+       has fewer than len / 2 + 1 tokens and as many commands, and the token
+       array has room for every command's NULL terminator */
+    size_t max_cmds = len / 2 + 2;
+    ArenaReset(a, (len + 2) * sizeof(char *) + max_cmds * sizeof(command) + 32);
+    char **tokens = (char **) ArenaAlloc(a, (len + 2) * sizeof(char *));
+    cmd_list->cmds = (command *) ArenaAlloc(a, max_cmds * sizeof(command));
+    cmd_list->count = 0;
+    cmd_list->background = false;
 
-                /* Check if redirect is > 1. If so, then deallocate everything and return NULL */
-                if ((redirection_i <= 1) || new_cmd->redirection.count > 1) {
-                    /* Either too many redirects or missing redirect file */
-                    DeleteCommand(new_cmd);
-                    ResetCommandList(cmd_list);
-                    /* Error occurred */
-                    write(STDERR_FILENO, error_message, strlen(error_message));
-                   break;
+    int num_tokens = 0;
+    bool in_redirect = false;   // a '>' has been seen in the current command
+    command *cmd = &cmd_list->cmds[0];
+    cmd->argv = tokens;
+    cmd->argc = 0;
+    cmd->redirect = NULL;
+    cmd->pipe_next = false;
+
+    for (char *p = line; ; ) {
+        char c = *p;
+        if (c == ' ' || c == '\t') {
+            *p++ = '\0';
+        } else if (c == '>') {
+            if (in_redirect || cmd->argc == 0) {
+                /* Multiple redirects, or nothing to redirect */
+                goto error;
+            }
+            in_redirect = true;
+            *p++ = '\0';
+        } else if (c == '\0' || c == '\n' || c == '&' || c == '|') {
+            /* End of a command */
+            bool piped_into = cmd_list->count > 0 && cmd_list->cmds[cmd_list->count - 1].pipe_next;
+            if (in_redirect && cmd->redirect == NULL) {
+                /* Missing redirect file */
+                goto error;
+            }
+            if (cmd->argc == 0) {
+                /* An empty command is skipped, but every stage of a pipeline
+                   needs one */
+                if (c == '|' || piped_into) {
+                    goto error;
                 }
             } else {
-                /* parse on whitespaces since there is no redirection */
-                while ((whitespace_sep_ptr = strsep(&parallel_sep_ptr, " \t")) != NULL) {
-                    if (*whitespace_sep_ptr != '\0') {
-                        char *temp_ptr = strdup(whitespace_sep_ptr);
-                        if (temp_ptr == NULL) {
-                            while(1);
-                        }
-                        InsertList(&new_cmd->argv, temp_ptr);
-                    }
+                tokens[num_tokens++] = NULL;
+                cmd->pipe_next = (c == '|');
+                cmd_list->background = (c == '&');
+                cmd_list->count++;
+                cmd = &cmd_list->cmds[cmd_list->count];
+            }
+            if (c == '\0') {
+                break;
+            }
+            *p++ = '\0';
+            cmd->argv = tokens + num_tokens;
+            cmd->argc = 0;
+            cmd->redirect = NULL;
+            cmd->pipe_next = false;
+            in_redirect = false;
+        } else {
+            /* A token runs up to the next delimiter */
+            char *token = p;
+            p += strcspn(p, " \t>&|\n");
+            if (in_redirect) {
+                if (cmd->redirect != NULL) {
+                    /* Multiple files to the right of '>' */
+                    goto error;
                 }
+                cmd->redirect = token;
+            } else {
+                tokens[num_tokens++] = token;
+                cmd->argc++;
             }
-            InsertList(cmd_list, new_cmd);
         }
     }
+    return true;
+
+error:
+    cmd_list->count = 0;
+    return false;
+}
+
+static void BufferPut(byte_buffer *buf, const void *data, size_t len) {
+    if (buf->len + len > buf->cap) {
+        buf->cap = buf->len + len > 2 * buf->cap ? buf->len + len : 2 * buf->cap;
+        buf->data = (char *) realloc(buf->data, buf->cap);
+        if (buf->data == NULL) {
+            while(1);
+        }
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
 }
 
-static void DeleteCommand(command *cmd) {
-    char *arg_str = PopList(&cmd->argv);
-    while (arg_str != NULL) {
-        free(arg_str);
-        arg_str = PopList(&cmd->argv);
+/* Parses every line of the script at fp into the compact form below, makes
+   it the source of src's lines, and saves it to cache_path for later runs.
+   Each non-empty line is a record of
+       uint32 line number, uint32 count, uint32 slots, uint8 background
+   (count is COMPILED_ERROR for a line with a syntax error, and slots the
+   argv entries its commands need), then for each command
+       uint32 argc, uint8 flags, argc NUL-terminated words [, redirect file]
+   Failing to save the cache is not an error; the script just runs.
+*/
+static bool CompileScript(FILE *fp, const struct stat *st, const char *cache_path,
+                          input_source *src) {
+    byte_buffer buf = {NULL, 0, 0};
+    compiled_header hdr;
+    command_list cmds;
+    arena line_arena = {NULL, 0, 0};
+    char *line = NULL;
+    size_t cap = 0;
+    uint32_t line_number = 0;
+
+    memset(&hdr, 0, sizeof(hdr));
+    BufferPut(&buf, &hdr, sizeof(hdr));
+    while (getline(&line, &cap, fp) != -1) {
+        line_number++;
+        uint32_t count = COMPILED_ERROR;
+        uint32_t slots = 0;
+        uint8_t background = 0;
+
+        if (ParseCommandList(&cmds, line, &line_arena)) {
+            if (cmds.count == 0) {
+                continue;
+            }
+            count = cmds.count;
+            for (int i = 0; i < cmds.count; i++) {
+                slots += cmds.cmds[i].argc + 1;
+            }
+            background = cmds.background;
+        }
+        BufferPut(&buf, &line_number, sizeof(line_number));
+        BufferPut(&buf, &count, sizeof(count));
+        BufferPut(&buf, &slots, sizeof(slots));
+        BufferPut(&buf, &background, sizeof(background));
+        for (uint32_t i = 0; count != COMPILED_ERROR && i < count; i++) {
+            command *cmd = &cmds.cmds[i];
+            uint32_t argc = cmd->argc;
+            uint8_t flags = (cmd->pipe_next ? COMPILED_PIPE : 0) |
+                            (cmd->redirect != NULL ? COMPILED_REDIRECT : 0);
+            BufferPut(&buf, &argc, sizeof(argc));
+            BufferPut(&buf, &flags, sizeof(flags));
+            for (int j = 0; j < cmd->argc; j++) {
+                BufferPut(&buf, cmd->argv[j], strlen(cmd->argv[j]) + 1);
+            }
+            if (cmd->redirect != NULL) {
+                BufferPut(&buf, cmd->redirect, strlen(cmd->redirect) + 1);
+            }
+        }
+        hdr.num_lines++;
+    }
+    free(line);
+    free(line_arena.base);
+    if (ferror(fp)) {
+        free(buf.data);
+        return false;
     }
 
-    char *redirect_str = PopList(&cmd->redirection);
-    while (redirect_str != NULL) {
-        free(redirect_str);
-        redirect_str = PopList(&cmd->redirection);
+    memcpy(hdr.magic, COMPILED_MAGIC, 4);
+    hdr.mtime_sec = st->st_mtim.tv_sec;
+    hdr.mtime_nsec = st->st_mtim.tv_nsec;
+    hdr.script_size = st->st_size;
+    hdr.data_size = buf.len - sizeof(hdr);
+    memcpy(buf.data, &hdr, sizeof(hdr));
+
+    /* Write a temporary file and rename it, so a concurrent run never
+       reads a partial cache */
+    char tmp_path[PATH_MAX];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.%d", cache_path, (int) getpid()) <
+        (int) sizeof(tmp_path)) {
+        int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd != -1) {
+            bool written = write(fd, buf.data, buf.len) == (ssize_t) buf.len;
+            if (close(fd) == 0 && written) {
+                rename(tmp_path, cache_path);
+            }
+            unlink(tmp_path);
+        }
     }
 
-    free(cmd);
+    src->compiled = buf.data;
+    src->compiled_size = buf.len;
+    src->pos = sizeof(hdr);
+    return true;
 }
 
-/* Frees up malloced data and resets variables */
-static void ResetCommandList(linkedlist *cmd_list_ptr) {
-    assert(cmd_list_ptr);
-    command *cmd = PopList(cmd_list_ptr);
-    while(cmd!= NULL) {
-        DeleteCommand(cmd);
-        cmd = PopList(cmd_list_ptr);
+/* Makes the compiled script at cache_path the source of src's lines, if it
+   was compiled from the script as it is now */
+static bool LoadCompiledScript(const struct stat *st, const char *cache_path,
+                               input_source *src) {
+    compiled_header hdr;
+    struct stat cache_st;
+
+    int fd = open(cache_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
     }
-    
+    if (fstat(fd, &cache_st) == -1 || cache_st.st_size < (off_t) sizeof(hdr) ||
+        read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+        memcmp(hdr.magic, COMPILED_MAGIC, 4) != 0 ||
+        hdr.mtime_sec != st->st_mtim.tv_sec || hdr.mtime_nsec != st->st_mtim.tv_nsec ||
+        hdr.script_size != (uint64_t) st->st_size ||
+        hdr.data_size != cache_st.st_size - sizeof(hdr)) {
+        close(fd);
+        return false;
+    }
+
+    src->compiled = (char *) malloc(cache_st.st_size);
+    if (src->compiled == NULL) {
+        while(1);
+    }
+    memcpy(src->compiled, &hdr, sizeof(hdr));
+    size_t done = sizeof(hdr);
+    while (done < (size_t) cache_st.st_size) {
+        ssize_t n = read(fd, src->compiled + done, cache_st.st_size - done);
+        if (n <= 0) {
+            free(src->compiled);
+            src->compiled = NULL;
+            close(fd);
+            return false;
+        }
+        done += n;
+    }
+    close(fd);
+    src->compiled_size = cache_st.st_size;
+    src->pos = sizeof(hdr);
+    return true;
 }
 
+/* Returns the next len bytes of the compiled script, or NULL past its end */
+static const void *TakeCompiled(input_source *src, size_t len) {
+    if (len > src->compiled_size - src->pos) {
+        return NULL;
+    }
+    src->pos += len;
+    return src->compiled + src->pos - len;
+}
 
-static void Run(int mode, char *file_path) {
-#if 0
-    linkedlist cmds,path;
-    InitList(&path);
-    InsertList(&path, strdup("/bin"));
-    InitList(&cmds);
-    FILE *fp;
-    char *line;
-    size_t nread, len;
+static const char *TakeCompiledString(input_source *src) {
+    char *start = src->compiled + src->pos;
+    char *end = memchr(start, '\0', src->compiled_size - src->pos);
+    return end == NULL ? NULL : TakeCompiled(src, end + 1 - start);
+}
 
-    if (mode == BATCH_MODE) {
-        /* Try to open the file. Throw error and quit if it cannot be opened */
-        fp = fopen(file_path, "r");
-        if (fp == NULL) {
+/* Rebuilds the next line of a compiled script in cmd_list. The words are
+   not copied; argv points into the compiled script. Returns 1 for a line,
+   0 at the end of the script, -1 for a line with a syntax error, -2 if the
+   record is truncated or malformed */
+static int NextCompiledLine(input_source *src, command_list *cmd_list, arena *a) {
+    uint32_t line_number;
+    uint32_t count;
+    uint32_t slots;
+    const void *field;
+
+    cmd_list->count = 0;
+    cmd_list->background = false;
+    if (src->pos == src->compiled_size) {
+        return 0;
+    }
+    if ((field = TakeCompiled(src, sizeof(line_number))) == NULL) {
+        return -2;
+    }
+    memcpy(&line_number, field, sizeof(line_number));
+    if (line_number <= src->line_number) {
+        /* Lines are stored in order */
+        return -2;
+    }
+    cmd_list->line_number = line_number;
+    if ((field = TakeCompiled(src, sizeof(count))) == NULL) {
+        return -2;
+    }
+    memcpy(&count, field, sizeof(count));
+    if ((field = TakeCompiled(src, sizeof(slots))) == NULL) {
+        return -2;
+    }
+    memcpy(&slots, field, sizeof(slots));
+    if ((field = TakeCompiled(src, sizeof(uint8_t))) == NULL) {
+        return -2;
+    }
+    if (count == COMPILED_ERROR) {
+        src->line_number = line_number;
+        return -1;
+    }
+    if (count > src->compiled_size || slots > src->compiled_size) {
+        /* More than the script could hold; corrupt */
+        return -2;
+    }
+    cmd_list->background = *(const uint8_t *) field;
+
+    ArenaReset(a, slots * sizeof(char *) + count * sizeof(command) + 32);
+    char **tokens = (char **) ArenaAlloc(a, slots * sizeof(char *));
+    cmd_list->cmds = (command *) ArenaAlloc(a, count * sizeof(command));
+    for (uint32_t i = 0; i < count; i++) {
+        command *cmd = &cmd_list->cmds[i];
+        uint32_t argc;
+        uint8_t flags;
+
+        if ((field = TakeCompiled(src, sizeof(argc))) == NULL) {
+            return -2;
+        }
+        memcpy(&argc, field, sizeof(argc));
+        if ((field = TakeCompiled(src, sizeof(flags))) == NULL ||
+            argc + 1 > slots || argc == 0) {
+            return -2;
+        }
+        flags = *(const uint8_t *) field;
+        slots -= argc + 1;
+
+        cmd->argv = tokens;
+        cmd->argc = argc;
+        cmd->pipe_next = (flags & COMPILED_PIPE) != 0;
+        cmd->redirect = NULL;
+        for (uint32_t j = 0; j < argc; j++) {
+            if ((tokens[j] = (char *) TakeCompiledString(src)) == NULL) {
+                return -2;
+            }
+        }
+        tokens[argc] = NULL;
+        tokens += argc + 1;
+        if ((flags & COMPILED_REDIRECT) &&
+            (cmd->redirect = (char *) TakeCompiledString(src)) == NULL) {
+            return -2;
+        }
+        cmd_list->count++;
+    }
+    src->line_number = line_number;
+    return 1;
+}
+
+/* Fetches the next line as a command list. Returns false at the end of
+   input. A syntax error is reported here and leaves the list empty */
+static bool NextCommandList(input_source *src, command_list *cmd_list, arena *a) {
+    if (src->compiled != NULL) {
+        int ret = NextCompiledLine(src, cmd_list, a);
+        if (ret == -1) {
             write(STDERR_FILENO, error_message, strlen(error_message));
-            exit(1);
         }
+        if (ret != -2) {
+            return ret != 0;
+        }
+
+        /* The cache is damaged: drop it, and run the rest of the script
+           from the source, after the last line already run */
+        unlink(src->cache_path);
+        free(src->compiled);
+        src->compiled = NULL;
+        rewind(src->fp);
+        for (unsigned int i = 0; i < src->line_number; i++) {
+            if (getline(&src->line, &src->line_cap, src->fp) == -1) {
+                return false;
+            }
+        }
+    }
+
+    /* getline() reuses the line buffer, and the arena is reset by the
+       parser, so steady-state lines allocate nothing */
+    if (getline(&src->line, &src->line_cap, src->fp) == -1) {
+        return false;
+    }
+    if (!ParseCommandList(cmd_list, src->line, a)) {
+        write(STDERR_FILENO, error_message, strlen(error_message));
+    }
+    cmd_list->line_number = ++src->line_number;
+    return true;
+}
+
+/* FNV-1a */
+static unsigned int HashName(const char *name) {
+    unsigned int hash = 2166136261u;
+    while (*name != '\0') {
+        hash = (hash ^ (unsigned char) *name++) * 16777619u;
+    }
+    return hash % HASH_BUCKETS;
+}
+
+static void ClearHash(void) {
+    for (int i = 0; i < HASH_BUCKETS; i++) {
+        hash_entry *entry = cmd_hash[i];
+        while (entry != NULL) {
+            hash_entry *next = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+            entry = next;
+        }
+        cmd_hash[i] = NULL;
+    }
+}
+
+/* Returns the location of name in path, or NULL if it is not found.
+   Hits are served from cmd_hash; misses probe every path directory with
+   access() and cache the result. The returned string belongs to the cache
+   and stays valid until the cache is cleared.
+*/
+static const char *LookupCommand(linkedlist *path, const char *name) {
+    hash_entry **bucket, *entry;
+    struct stat st;
+    char candidate[PATH_MAX];
+
+    if (name == NULL) {
+        return NULL;
+    }
+    bucket = &cmd_hash[HashName(name)];
+    for (hash_entry **link = bucket; (entry = *link) != NULL; link = &entry->next) {
+        if (strcmp(entry->name, name) != 0) {
+            continue;
+        }
+        if (!hash_revalidate) {
+            return entry->path;
+        }
+        /* The binary must still be the same executable file */
+        if (stat(entry->path, &st) == 0 && (st.st_mode & S_IXUSR) &&
+            st.st_dev == entry->dev && st.st_ino == entry->ino) {
+            return entry->path;
+        }
+        *link = entry->next;
+        free(entry->name);
+        free(entry->path);
+        free(entry);
+        break;
+    }
+
+    /* Iterate through paths to see if cmd is in one of them */
+    for (node *current_path_node = path->head; current_path_node != NULL;
+         current_path_node = current_path_node->next) {
+        snprintf(candidate, sizeof(candidate), "%s/%s", (char *) current_path_node->data, name);
+        if (access(candidate, X_OK) == 0 && stat(candidate, &st) == 0) {
+            entry = (hash_entry *) malloc(sizeof(hash_entry));
+            if (entry == NULL) {
+                while(1);
+            }
+            entry->name = strdup(name);
+            entry->path = strdup(candidate);
+            if (entry->name == NULL || entry->path == NULL) {
+                while(1);
+            }
+            entry->dev = st.st_dev;
+            entry->ino = st.st_ino;
+            entry->next = *bucket;
+            *bucket = entry;
+            return entry->path;
+        }
+    }
+    return NULL;
+}
+
+/* hash: list the cache. hash -r: clear it.
+   hash -s on|off: turn stat revalidation of cached entries on or off.
+*/
+static void HashBuiltin(int argc, char **argv) {
+    char *opt = argc > 1 ? argv[1] : NULL;
+    char *value = argc > 2 ? argv[2] : NULL;
+
+    if (opt == NULL) {
+        for (int i = 0; i < HASH_BUCKETS; i++) {
+            for (hash_entry *entry = cmd_hash[i]; entry != NULL; entry = entry->next) {
+                printf("%s\t%s\n", entry->name, entry->path);
+            }
+        }
+        fflush(stdout);
+    } else if (strcmp(opt, "-r") == 0 && value == NULL) {
+        ClearHash();
+    } else if (strcmp(opt, "-s") == 0 && argc == 3 &&
+               (strcmp(value, "on") == 0 || strcmp(value, "off") == 0)) {
+        hash_revalidate = strcmp(value, "on") == 0;
+    } else {
+        write(STDERR_FILENO, error_message, strlen(error_message));
+    }
+}
+
+/* Starts cmd_path with argv. The child reads from in_fd and writes to out_fd
+   unless they are -1, and its stdout goes to redirect_file if one is given.
+   The child needs nothing but fd plumbing, so posix_spawn() can start it
+   without copying the shell's page tables; fork() remains the fallback if
+   spawning fails. Returns the child's pid, or -1.
+*/
+static pid_t LaunchCommand(const char *cmd_path, char **argv, int in_fd, int out_fd,
+                           const char *redirect_file, double *exec_latency) {
+    pid_t pid;
+    double start = exec_latency != NULL ? Now() : 0;
+
+    if (launch_mode == LAUNCH_SPAWN) {
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        if (in_fd != -1) {
+            posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+        }
+        if (out_fd != -1) {
+            posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+        }
+        if (redirect_file != NULL) {
+            posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, redirect_file,
+                                             O_CREAT|O_WRONLY|O_TRUNC, S_IRWXU);
+        }
+        int err = posix_spawn(&pid, cmd_path, &actions, NULL, argv, environ);
+        posix_spawn_file_actions_destroy(&actions);
+        if (err == 0) {
+            /* glibc's posix_spawn() returns once the child has exec'ed */
+            if (exec_latency != NULL) {
+                *exec_latency = Now() - start;
+            }
+            return pid;
+        }
+    }
+
+    /* To time the exec when profiling, the child holds the write end of a
+       close-on-exec pipe, which reads as EOF once execv() succeeds */
+    int exec_pipe[2] = {-1, -1};
+    if (exec_latency != NULL) {
+        start = Now();
+        if (pipe2(exec_pipe, O_CLOEXEC) == -1) {
+            exec_pipe[0] = exec_pipe[1] = -1;
+        }
+    }
+
+    pid = fork();
+    if (pid == 0) {
+        if (in_fd != -1) {
+            dup2(in_fd, STDIN_FILENO);
+        }
+        if (out_fd != -1) {
+            dup2(out_fd, STDOUT_FILENO);
+        }
+        if (redirect_file != NULL) {
+            close(STDOUT_FILENO);
+            open(redirect_file, O_CREAT|O_WRONLY|O_TRUNC, S_IRWXU);
+        }
+
+        execv(cmd_path, argv);
+        _exit(0);
+    }
+    if (exec_pipe[0] != -1) {
+        char c;
+        close(exec_pipe[1]);
+        while (pid > 0 && read(exec_pipe[0], &c, 1) == -1 && errno == EINTR);
+        close(exec_pipe[0]);
+    }
+    if (exec_latency != NULL) {
+        *exec_latency = Now() - start;
+    }
+    return pid;
+}
+
+/* Only records the event; children are reaped from the main loop, so a
+   foreground wait never has its child stolen */
+static void SigchldHandler(int sig) {
+    (void) sig;
+    child_exited = 1;
+}
+
+/* Adds the launched commands of a background line to the job table */
+static void AddJob(command_list *cmds, bool report) {
+    if (num_jobs == jobs_cap) {
+        jobs_cap = jobs_cap ? 2 * jobs_cap : 16;
+        jobs = (job *) realloc(jobs, jobs_cap * sizeof(job));
+        if (jobs == NULL) {
+            while(1);
+        }
+    }
+
+    job *new_job = &jobs[num_jobs];
+    new_job->pids = (pid_t *) malloc(cmds->count * sizeof(pid_t));
+    new_job->num_pids = 0;
+    size_t cmdline_len = 1;
+    for (int i = 0; i < cmds->count; i++) {
+        for (int j = 0; j < cmds->cmds[i].argc; j++) {
+            cmdline_len += strlen(cmds->cmds[i].argv[j]) + 1;
+        }
+        cmdline_len += 4;   // " | " or " & "
+        if (cmds->cmds[i].redirect != NULL) {
+            cmdline_len += strlen(cmds->cmds[i].redirect) + 3;
+        }
+    }
+    new_job->cmdline = (char *) malloc(cmdline_len);
+    if (new_job->pids == NULL || new_job->cmdline == NULL) {
+        while(1);
+    }
+
+    /* Rebuild the command line; the parser has split the original */
+    char *pos = new_job->cmdline;
+    for (int i = 0; i < cmds->count; i++) {
+        command *cmd = &cmds->cmds[i];
+        if (cmd->pid > 0) {
+            new_job->pids[new_job->num_pids++] = cmd->pid;
+        }
+        for (int j = 0; j < cmd->argc; j++) {
+            pos += sprintf(pos, j > 0 ? " %s" : "%s", cmd->argv[j]);
+        }
+        if (cmd->redirect != NULL) {
+            pos += sprintf(pos, " > %s", cmd->redirect);
+        }
+        pos += sprintf(pos, cmd->pipe_next ? " | " : " &");
+        if (!cmd->pipe_next && i + 1 < cmds->count) {
+            *pos++ = ' ';
+        }
+    }
+    *pos = '\0';
+
+    if (new_job->num_pids == 0) {
+        free(new_job->pids);
+        free(new_job->cmdline);
+        return;
+    }
+    new_job->running = new_job->num_pids;
+    new_job->id = next_job_id++;
+    num_jobs++;
+    if (report) {
+        printf("[%d] %d\n", new_job->id, (int) new_job->pids[new_job->num_pids - 1]);
+        fflush(stdout);
+    }
+}
+
+/* Marks pid as finished in whichever job it belongs to */
+static void ChildExited(pid_t pid) {
+    for (int i = 0; i < num_jobs; i++) {
+        for (int j = 0; j < jobs[i].num_pids; j++) {
+            if (jobs[i].pids[j] == pid) {
+                jobs[i].pids[j] = -1;
+                jobs[i].running--;
+                return;
+            }
+        }
+    }
+}
+
+static void RemoveDoneJobs(bool report) {
+    int kept = 0;
+    for (int i = 0; i < num_jobs; i++) {
+        if (jobs[i].running > 0) {
+            jobs[kept++] = jobs[i];
+            continue;
+        }
+        if (report) {
+            printf("[%d] Done %s\n", jobs[i].id, jobs[i].cmdline);
+            fflush(stdout);
+        }
+        free(jobs[i].pids);
+        free(jobs[i].cmdline);
+    }
+    num_jobs = kept;
+    if (num_jobs == 0) {
+        next_job_id = 1;
+    }
+}
+
+/* Reaps every background child that has exited, without blocking */
+static void ReapJobs(bool report) {
+    pid_t pid;
+
+    if (!child_exited) {
+        return;
+    }
+    child_exited = 0;
+    while ((pid = WaitChild(-1, WNOHANG)) > 0) {
+        ChildExited(pid);
+    }
+    RemoveDoneJobs(report);
+}
+
+/* Blocks until job id, or every job if id is -1, has finished. Returns -1
+   if there is no such job */
+static int WaitJobs(int id) {
+    int found = -1;
+    for (int i = 0; i < num_jobs; i++) {
+        if (id != -1 && jobs[i].id != id) {
+            continue;
+        }
+        found = 0;
+        for (int j = 0; j < jobs[i].num_pids; j++) {
+            if (jobs[i].pids[j] > 0) {
+                WaitChild(jobs[i].pids[j], 0);
+                jobs[i].pids[j] = -1;
+                jobs[i].running--;
+            }
+        }
+    }
+    RemoveDoneJobs(false);
+    return found;
+}
+
+static void JobsBuiltin(void) {
+    for (int i = 0; i < num_jobs; i++) {
+        printf("[%d] Running %s\n", jobs[i].id, jobs[i].cmdline);
+    }
+    fflush(stdout);
+}
+
+static double Now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Launches every stage of the pipeline that starts at cmds->cmds[first].
+   Returns the index of the command after its last stage */
+static int StartPipeline(command_list *cmds, int first, linkedlist *path) {
+    int pipe_in = -1;   // read end of the pipe from the previous stage
+    int i = first;
+
+    cmds->cmds[first].started = Now();
+    cmds->cmds[first].elapsed = 0;
+    do {
+        command *current_cmd = &cmds->cmds[i];
+
+        /* Connect this stage to the next one. O_CLOEXEC keeps every
+           other child from holding the pipe open */
+        int pipe_fds[2] = {-1, -1};
+        if (current_cmd->pipe_next && pipe2(pipe_fds, O_CLOEXEC) == -1) {
+            write(STDERR_FILENO, error_message, strlen(error_message));
+        }
+
+        /* If command found in path, then execute it */
+        const char *cmd_path = LookupCommand(path, current_cmd->argv[0]);
+        current_cmd->pid = -1;
+        if (cmd_path != NULL) {
+            double started = Now();
+            double exec_latency;
+            current_cmd->pid = LaunchCommand(cmd_path, current_cmd->argv, pipe_in,
+                                             pipe_fds[1], current_cmd->redirect,
+                                             profile_path != NULL ? &exec_latency : NULL);
+            if (profile_path != NULL && current_cmd->pid > 0) {
+                ProfileLaunched(current_cmd, cmds->line_number, started, exec_latency);
+            }
+        } else {
+            write(STDERR_FILENO, error_message, strlen(error_message));
+        }
+
+        /* The children have their ends; keep only the read end
+           for the next stage */
+        if (pipe_in != -1) {
+            close(pipe_in);
+        }
+        if (pipe_fds[1] != -1) {
+            close(pipe_fds[1]);
+        }
+        pipe_in = pipe_fds[0];
+    } while (cmds->cmds[i++].pipe_next);
+
+    return i;
+}
+
+static bool PipelineRunning(command_list *cmds, int first) {
+    int i = first;
+    do {
+        if (cmds->cmds[i].pid > 0) {
+            return true;
+        }
+    } while (cmds->cmds[i++].pipe_next);
+    return false;
+}
+
+/* Runs the external commands of a line. At most parallel_limit of its
+   pipelines run at once; the rest wait in line order and start as earlier
+   ones exit. A background line starts everything and returns at once */
+static void RunCommandList(command_list *cmds, linkedlist *path, bool report) {
+    int limit = (cmds->background || parallel_limit == 0) ? INT_MAX : parallel_limit;
+    int next = 0;       // first command not yet started
+    int running = 0;    // pipelines with a stage still running
+    int num_pipelines = 0;
+    double line_start = Now();
+
+    while (1) {
+        while (next < cmds->count && running < limit) {
+            int first = next;
+            next = StartPipeline(cmds, first, path);
+            num_pipelines++;
+            if (PipelineRunning(cmds, first)) {
+                running++;
+            }
+        }
+        if (cmds->background) {
+            /* Return to the prompt at once; the children are reaped later */
+            AddJob(cmds, report);
+            return;
+        }
+        if (running == 0) {
+            break;
+        }
+
+        pid_t pid = WaitChild(-1, 0);
+        if (pid == -1) {
+            break;
+        }
+        int i;
+        for (i = 0; i < cmds->count && cmds->cmds[i].pid != pid; i++);
+        if (i == cmds->count) {
+            /* A background job's child; leave it for the job table */
+            ChildExited(pid);
+            continue;
+        }
+        cmds->cmds[i].pid = -1;
+        while (i > 0 && cmds->cmds[i - 1].pipe_next) {
+            i--;
+        }
+        if (!PipelineRunning(cmds, i)) {
+            cmds->cmds[i].elapsed = Now() - cmds->cmds[i].started;
+            running--;
+        }
+    }
+
+    if (parallel_timing) {
+        /* One line per pipeline, then the makespan of the whole line */
+        for (int i = 0; i < cmds->count; i++) {
+            command *first = &cmds->cmds[i];
+            fprintf(stderr, "parallel: %.3fs ", first->elapsed);
+            for ( ; ; i++) {
+                for (int j = 0; j < cmds->cmds[i].argc; j++) {
+                    fprintf(stderr, j > 0 ? " %s" : "%s", cmds->cmds[i].argv[j]);
+                }
+                if (!cmds->cmds[i].pipe_next) {
+                    break;
+                }
+                fprintf(stderr, " | ");
+            }
+            fprintf(stderr, "\n");
+        }
+        fprintf(stderr, "parallel: makespan %.3fs, %d command(s), limit %d\n",
+                Now() - line_start, num_pipelines, parallel_limit);
+    }
+}
+
+/* parallel: show the settings. parallel N: run at most N commands of a line
+   at once (0 for no limit). parallel -t on|off: report wall times */
+static void ParallelBuiltin(int argc, char **argv) {
+    char *end;
+
+    if (argc == 1) {
+        printf("parallel %d, timing %s\n", parallel_limit, parallel_timing ? "on" : "off");
+        fflush(stdout);
+    } else if (argc == 2 && argv[1][0] != '\0' &&
+               strtol(argv[1], &end, 10) >= 0 && *end == '\0') {
+        parallel_limit = (int) strtol(argv[1], NULL, 10);
+    } else if (argc == 3 && strcmp(argv[1], "-t") == 0 &&
+               (strcmp(argv[2], "on") == 0 || strcmp(argv[2], "off") == 0)) {
+        parallel_timing = strcmp(argv[2], "on") == 0;
     } else {
-        fp = stdin;
-    }    
-    line = NULL;
-    if ((nread = getline(&line, &len, fp)) != -1) {
-        printf("line: *%s*\n", line);
-        ParseCommandList(&cmds, line);
-        command *cmd;
-        int i = 0;
-        while ((cmd = PopList(&cmds)) != NULL) {
-            char *token;
-            printf("CMD %d:\n", i);
-            while ((token = PopList(&cmd->argv)) != NULL) {
-                printf("*%s* ", token);
-                free(token);
+        write(STDERR_FILENO, error_message, strlen(error_message));
+    }
+}
+
+/* waitpid(), which also completes the child's profile record when
+   profiling */
+static pid_t WaitChild(pid_t pid, int options) {
+    struct rusage usage;
+    int wstatus;
+
+    if (profile_path == NULL) {
+        return waitpid(pid, NULL, options);
+    }
+    pid = wait4(pid, &wstatus, options, &usage);
+    if (pid <= 0) {
+        return pid;
+    }
+    /* Records are in launch order, and a child is usually reaped soon
+       after it is launched, so search from the end */
+    for (size_t i = profile_len; i > 0; i--) {
+        profile_record *rec = &profile[i - 1];
+        if (rec->pid == pid && !rec->done) {
+            rec->wall = Now() - profile_start - rec->started;
+            rec->status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus);
+            rec->usage = usage;
+            rec->done = true;
+            break;
+        }
+    }
+    return pid;
+}
+
+static void ProfileLaunched(command *cmd, unsigned int line_number, double started,
+                            double exec_latency) {
+    if (profile_len == profile_cap) {
+        profile_cap = profile_cap ? 2 * profile_cap : 256;
+        profile = (profile_record *) realloc(profile, profile_cap * sizeof(profile_record));
+        if (profile == NULL) {
+            while(1);
+        }
+    }
+
+    size_t cmdline_len = 1;
+    for (int i = 0; i < cmd->argc; i++) {
+        cmdline_len += strlen(cmd->argv[i]) + 1;
+    }
+    if (cmd->redirect != NULL) {
+        cmdline_len += strlen(cmd->redirect) + 3;
+    }
+    profile_record *rec = &profile[profile_len++];
+    memset(rec, 0, sizeof(*rec));
+    rec->cmdline = (char *) malloc(cmdline_len);
+    if (rec->cmdline == NULL) {
+        while(1);
+    }
+    char *pos = rec->cmdline;
+    for (int i = 0; i < cmd->argc; i++) {
+        pos += sprintf(pos, i > 0 ? " %s" : "%s", cmd->argv[i]);
+    }
+    if (cmd->redirect != NULL) {
+        sprintf(pos, " > %s", cmd->redirect);
+    }
+    rec->line_number = line_number;
+    rec->pid = cmd->pid;
+    rec->started = started - profile_start;
+    rec->exec_latency = exec_latency;
+}
+
+/* Writes the profile to profile_path, as JSON if its name ends in .json
+   and as CSV otherwise. Commands that were never reaped have a status
+   of -1 and no resource usage */
+static void WriteProfile(void) {
+    if (profile_path == NULL) {
+        return;
+    }
+    size_t path_len = strlen(profile_path);
+    bool json = path_len >= 5 && strcmp(profile_path + path_len - 5, ".json") == 0;
+    FILE *out = fopen(profile_path, "w");
+    if (out == NULL) {
+        write(STDERR_FILENO, error_message, strlen(error_message));
+        return;
+    }
+
+    if (json) {
+        fprintf(out, "[\n");
+    } else {
+        fprintf(out, "line,pid,status,start_s,exec_latency_us,wall_s,user_s,sys_s,"
+                     "max_rss_kb,minor_faults,major_faults,voluntary_cs,involuntary_cs,"
+                     "command\n");
+    }
+    for (size_t i = 0; i < profile_len; i++) {
+        profile_record *rec = &profile[i];
+        struct rusage *ru = &rec->usage;
+        double user = ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6;
+        double sys = ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+        int status = rec->done ? rec->status : -1;
+
+        if (json) {
+            fprintf(out, "  {\"line\": %u, \"pid\": %d, \"status\": %d, \"start_s\": %.6f, "
+                         "\"exec_latency_us\": %.1f, \"wall_s\": %.6f, \"user_s\": %.6f, "
+                         "\"sys_s\": %.6f, \"max_rss_kb\": %ld, \"minor_faults\": %ld, "
+                         "\"major_faults\": %ld, \"voluntary_cs\": %ld, "
+                         "\"involuntary_cs\": %ld, \"command\": \"",
+                    rec->line_number, (int) rec->pid, status, rec->started,
+                    rec->exec_latency * 1e6, rec->wall, user, sys, ru->ru_maxrss,
+                    ru->ru_minflt, ru->ru_majflt, ru->ru_nvcsw, ru->ru_nivcsw);
+            for (const char *c = rec->cmdline; *c != '\0'; c++) {
+                if (*c == '"' || *c == '\\') {
+                    fprintf(out, "\\%c", *c);
+                } else if ((unsigned char) *c < 0x20) {
+                    fprintf(out, "\\u%04x", *c);
+                } else {
+                    fputc(*c, out);
+                }
             }
-            printf("\n------\n");
-            while ((token = PopList(&cmd->redirection)) != NULL) {
-                printf("*%s* ", token);
-                free(token);
+            fprintf(out, "\"}%s\n", i + 1 < profile_len ? "," : "");
+        } else {
+            fprintf(out, "%u,%d,%d,%.6f,%.1f,%.6f,%.6f,%.6f,%ld,%ld,%ld,%ld,%ld,\"",
+                    rec->line_number, (int) rec->pid, status, rec->started,
+                    rec->exec_latency * 1e6, rec->wall, user, sys, ru->ru_maxrss,
+                    ru->ru_minflt, ru->ru_majflt, ru->ru_nvcsw, ru->ru_nivcsw);
+            for (const char *c = rec->cmdline; *c != '\0'; c++) {
+                if (*c == '"') {
+                    fputc('"', out);
+                }
+                fputc(*c, out);
             }
-            printf("\n------\n");    
-            DeleteCommand(cmd);
-            i++;
+            fprintf(out, "\"\n");
         }
-        ResetCommandList(&cmds);
-        free(line);
-        line = NULL;
+        free(rec->cmdline);
     }
-    ResetPath(&path);
-    return;
-#else
-    FILE *fp;
-    char *line;
-    size_t nread, len;
-    linkedlist path, cmds;
+    if (json) {
+        fprintf(out, "]\n");
+    }
+    if (fclose(out) != 0) {
+        write(STDERR_FILENO, error_message, strlen(error_message));
+    }
+    free(profile);
+    profile = NULL;
+    profile_len = 0;
+}
+
+static void Run(int mode, char *file_path) {
+    input_source src;
+    char cache_path[PATH_MAX];
+    linkedlist path;
+    command_list cmds;
+    arena line_arena = {NULL, 0, 0};
+
+    memset(&src, 0, sizeof(src));
+    src.cache_path = cache_path;
 
     if (mode == BATCH_MODE) {
         /* Try to open the file. Throw error and quit if it cannot be opened */
-        fp = fopen(file_path, "r");
-        if (fp == NULL) {
+        src.fp = fopen(file_path, "r");
+        if (src.fp == NULL) {
             write(STDERR_FILENO, error_message, strlen(error_message));
             exit(1);
         }
+
+        /* Run from the compiled script if it is current, else compile it */
+        struct stat st;
+        if (compile_scripts && fstat(fileno(src.fp), &st) == 0 && S_ISREG(st.st_mode) &&
+            snprintf(cache_path, sizeof(cache_path), "%s%s", file_path, COMPILED_SUFFIX) <
+            (int) sizeof(cache_path) &&
+            !LoadCompiledScript(&st, cache_path, &src)) {
+            CompileScript(src.fp, &st, cache_path, &src);
+        }
     } else {
-        fp = stdin;
+        src.fp = stdin;
     }
-    
+
     /* Initialize the path list */
     InitList(&path);
     char *initial_path = strdup("/bin");
@@ -277,148 +1320,98 @@ static void Run(int mode, char *file_path) {
     }
     InsertList(&path, initial_path);
 
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SigchldHandler;
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, NULL);
+
     while(1) {
+        ReapJobs(mode == INTERACTIVE_MODE);
         if (mode == INTERACTIVE_MODE) {
             printf("wish> ");
         }
-        line = NULL;
-        if ((nread = getline(&line, &len, fp)) != -1) {
-            InitList(&cmds);
-            ParseCommandList(&cmds, line);
-            free(line);
-            command *current_cmd = PopList(&cmds);
-            if (current_cmd != NULL) {
-                char *first_arg = PopList(&current_cmd->argv);
-                if (first_arg != NULL) {
-                    if (strcmp(first_arg, "exit") == 0) {
-                        if (current_cmd->argv.count > 0) {
-                            /* Error */
-                            write(STDERR_FILENO, error_message, strlen(error_message));
-                        } else {
-                            DeleteCommand(current_cmd);
-                            ResetCommandList(&cmds);
-                            free(first_arg);
-                            ResetPath(&path);
-                            exit(0);
-                        }
-                        free(first_arg);
-                        DeleteCommand(current_cmd);                        
-                    } else if (strcmp(first_arg, "cd") == 0) {
-                        if (current_cmd->argv.count != 1) {
-                            write(STDERR_FILENO, error_message, strlen(error_message));
-                        } else {
-                            char *cd_path = PopList(&current_cmd->argv);
-                            if (chdir(cd_path) == -1) {
-                                /* chdir failed so throw an error */
-                                write(STDERR_FILENO, error_message, strlen(error_message));
-                            }
-                            free(cd_path);
-                        }
-                        free(first_arg);
-                        DeleteCommand(current_cmd);
-                    } else if(strcmp(first_arg, "path") == 0) {
-                        /* Clear path then iterate through all the arguments and add to path */
-                        ResetPath(&path);
-                        char *curr_loc;
-                        while((curr_loc = PopList(&current_cmd->argv)) != NULL){
-                            char *temp_ptr = strdup(curr_loc);
-                            if (temp_ptr == NULL) {
-                                while(1);
-                            }
-                            InsertList(&path, temp_ptr);
-                            free(curr_loc);
-                        }
-                        free(first_arg);
-                        DeleteCommand(current_cmd);
-                    } else {
-                        /* System command. */
-                        while(current_cmd != NULL) {
-                            /* Iterate through paths to see if cmd is in one of them */
-                            node *current_path_node = path.head;
-                            char *cmd_path = NULL;
-                            while (current_path_node != NULL) {
-                                int temp_path_str_len = strlen(current_path_node->data) + strlen(first_arg) + 1;
-                                char *temp_path_str = (char *) malloc(temp_path_str_len + 1);
-                                sprintf(temp_path_str, "%s/%s", (char *) current_path_node->data, first_arg);
-                                if (access(temp_path_str, X_OK) == 0) {
-                                    cmd_path = temp_path_str;
-                                    break;
-                                }
-                                free(temp_path_str);
-                                current_path_node = current_path_node->next;
-                            }
-                            
-                            /* If command found in path, then get args and execute */
-                            if (cmd_path != NULL){
-                                int my_argc = current_cmd->argv.count + 1;  //+1 for the one that has already been popped
-                                char **my_args = (char **)malloc(sizeof(char *)*(my_argc + 1)); //+1 for null termination
-                                my_args[0] = first_arg;
-                                my_args[my_argc] = NULL;    // NULL terminate the arg list
-                                for (int i = 1; i < my_argc; i++) {
-                                    my_args[i] = PopList(&current_cmd->argv);
-                                }
-
-                                char *redirect_file = NULL;
-                                if(current_cmd->redirection.count > 0) {
-                                    /* Redirect output to specified file */
-                                    redirect_file = PopList(&current_cmd->redirection);
-                                }
-
-                                /* Create the child process and execute the command */
-                                int rc = fork();
-                                if (rc < 0) {
-                                    /* Error */
-                                } else if (rc == 0) {
-                                    if (redirect_file != NULL) {
-                                        close(STDOUT_FILENO);
-                                        open(redirect_file, O_CREAT|O_WRONLY|O_TRUNC, S_IRWXU);                                 
-                                    }
-
-                                    execv(cmd_path, my_args);
-                                    _exit(0);
-                                } else {
-                                    /* Parent enters here */
-                                    /* Free the memory allocated for the arg list */
-                                    for (int i = 0; i < my_argc; i++) {
-                                        free(my_args[i]);
-                                    }
-                                    free(my_args);
-                                    free(cmd_path);
-
-                                    if (redirect_file != NULL) {
-                                        free(redirect_file);
-                                    }
-                                }
-                            } else {
-                                write(STDERR_FILENO, error_message, strlen(error_message));
-                            }
-
-                            /* Free current command memory and get the next one */
-                            DeleteCommand(current_cmd);
-                            current_cmd = PopList(&cmds);
-                            if (current_cmd != NULL) {
-                                first_arg = PopList(&current_cmd->argv);
-                            }
-                        }
-                        /* Wait for cmd(s) to finish executing */
-                        int wpid, wstatus;
-                        while ((wpid = wait(&wstatus)) > 0);
-                    }
-                } else {
-                    DeleteCommand(current_cmd);
-                }
-            } else {
+        if (!NextCommandList(&src, &cmds, &line_arena)) {
+            if (mode == BATCH_MODE) {
+                /* EOF, exit gracefully once background jobs are done */
+                WaitJobs(-1);
+                WriteProfile();
+                free(src.line);
+                free(src.compiled);
+                free(line_arena.base);
+                ResetPath(&path);
+                ClearHash();
+                exit(0);
             }
+            continue;
+        }
 
-            ResetCommandList(&cmds);
-        } else {
-            free(line);
-            if (mode == BATCH_MODE) {
-                /* EOF, exit gracefully */
+        if (cmds.count == 0) {
+            continue;
+        }
+
+        command *first_cmd = &cmds.cmds[0];
+        char *first_arg = first_cmd->argv[0];
+        if (strcmp(first_arg, "exit") == 0) {
+            if (first_cmd->argc > 1) {
+                /* Error */
+                write(STDERR_FILENO, error_message, strlen(error_message));
+            } else {
+                /* Background jobs are not abandoned; wait for them first */
+                WaitJobs(-1);
+                WriteProfile();
+                free(src.line);
+                free(src.compiled);
+                free(line_arena.base);
                 ResetPath(&path);
+                ClearHash();
                 exit(0);
             }
+        } else if (strcmp(first_arg, "cd") == 0) {
+            if (first_cmd->argc != 2) {
+                write(STDERR_FILENO, error_message, strlen(error_message));
+            } else if (chdir(first_cmd->argv[1]) == -1) {
+                /* chdir failed so throw an error */
+                write(STDERR_FILENO, error_message, strlen(error_message));
+            } else {
+                /* Relative path entries now point elsewhere */
+                ClearHash();
+            }
+        } else if(strcmp(first_arg, "path") == 0) {
+            /* Clear path then iterate through all the arguments and add to path */
+            ResetPath(&path);
+            ClearHash();
+            for (int i = 1; i < first_cmd->argc; i++) {
+                char *temp_ptr = strdup(first_cmd->argv[i]);
+                if (temp_ptr == NULL) {
+                    while(1);
+                }
+                InsertList(&path, temp_ptr);
+            }
+        } else if (strcmp(first_arg, "hash") == 0) {
+            HashBuiltin(first_cmd->argc, first_cmd->argv);
+        } else if (strcmp(first_arg, "jobs") == 0) {
+            if (first_cmd->argc != 1) {
+                write(STDERR_FILENO, error_message, strlen(error_message));
+            } else {
+                JobsBuiltin();
+            }
+        } else if (strcmp(first_arg, "wait") == 0) {
+            /* wait: all jobs. wait N: job N */
+            char *end = NULL;
+            int id = first_cmd->argc == 2 ? (int) strtol(first_cmd->argv[1], &end, 10) : -1;
+            if (first_cmd->argc > 2 || (end != NULL && (*end != '\0' || id <= 0)) ||
+                WaitJobs(id) == -1) {
+                if (first_cmd->argc != 1) {
+                    write(STDERR_FILENO, error_message, strlen(error_message));
+                }
+            }
+        } else if (strcmp(first_arg, "parallel") == 0) {
+            ParallelBuiltin(first_cmd->argc, first_cmd->argv);
+        } else {
+            /* System command. */
+            RunCommandList(&cmds, &path, mode == INTERACTIVE_MODE);
         }
     }
-#endif
 }
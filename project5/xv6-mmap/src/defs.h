@@ -68,6 +68,10 @@ char*           kalloc(void);
 void            kfree(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+char*           kzalloc(void);
+void            kref(char*);
+int             krefcount(char*);
+void            kzrefill(void);
 
 // kmalloc.c
 void*           kmalloc(uint);
@@ -189,6 +193,8 @@ void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
+int             cowuvm(pde_t*, char*);
+int             cowrange(pde_t*, char*, uint);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
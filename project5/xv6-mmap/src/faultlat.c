@@ -0,0 +1,63 @@
+// Measure the cost of a page fault on lazily allocated mmap memory.
+//
+//   faultlat [npages [rounds]]
+//
+// Each round maps npages anonymous pages and times the first write
+// to each with the cycle counter, which takes the fault through
+// pagefault_handler(). Between rounds it sleeps a tick so that idle
+// CPUs can refill the kernel's pool of zeroed pages. Prints the mean
+// and minimum cycles per fault.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "mmu.h"
+#include "mman.h"
+
+static inline uint
+rdtsc(void)
+{
+  uint lo, hi;
+
+  asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+  return lo;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int npages, rounds, i, r;
+  uint start, cycles, total, min;
+  char *p;
+
+  npages = argc > 1 ? atoi(argv[1]) : 32;
+  rounds = argc > 2 ? atoi(argv[2]) : 20;
+  if(npages < 1 || rounds < 1){
+    printf(2, "usage: faultlat [npages [rounds]]\n");
+    exit();
+  }
+
+  total = 0;
+  min = ~0;
+  for(r = 0; r < rounds; r++){
+    p = mmap(0, npages*PGSIZE, PROT_WRITE, MAP_ANONYMOUS, -1, 0);
+    if(p == 0 || p == (char*)-1){
+      printf(1, "faultlat: mmap failed\n");
+      exit();
+    }
+    for(i = 0; i < npages; i++){
+      start = rdtsc();
+      p[i*PGSIZE] = 1;
+      cycles = rdtsc() - start;
+      total += cycles / 16;  // Scaled so the sum cannot overflow
+      if(cycles < min)
+        min = cycles;
+    }
+    munmap(p, npages*PGSIZE);
+    sleep(1);
+  }
+
+  printf(1, "faultlat: %d faults, mean %d cycles, min %d cycles\n",
+         npages*rounds, total / (npages*rounds) * 16, min);
+  exit();
+}
@@ -8,6 +8,23 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "spinlock.h"
+#include "proc.h"
+
+// Each CPU keeps a small cache of free pages so that most kalloc()
+// and kfree() calls take only that CPU's lock. A cache is refilled
+// from, and spills to, the global list KMEM_BATCH pages at a time.
+#define KMEM_BATCH      32
+#define KMEM_CACHE_MAX  (2*KMEM_BATCH)
+
+// Pages zeroed ahead of time by idle CPUs, for kzalloc().
+#define KMEM_ZERO_MAX   64
+
+// Build with KALLOC_JUNK=1 (see Makefile) to fill freed pages with
+// junk and catch dangling references. Off by default: it is a full
+// page write on every kfree().
+#ifndef KALLOC_JUNK
+#define KALLOC_JUNK 0
+#endif
 
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
@@ -17,10 +34,23 @@ struct run {
   struct run *next;
 };
 
+struct kmem_cache {
+  struct spinlock lock;  // Taken by the owning CPU, and by others to steal
+  struct run *freelist;
+  int nfree;
+};
+
 struct {
   struct spinlock lock;
   int use_lock;
   struct run *freelist;
+  struct kmem_cache cache[NCPU];
+  struct spinlock zlock;
+  struct run *zeroed;    // Pool of zero-filled pages
+  int nzero;
+  // References to each physical page, from page tables shared by
+  // copy-on-write fork. Updated with atomic instructions, not a lock.
+  ushort ref[PHYSTOP/PGSIZE];
 } kmem;
 
 // Initialization happens in two phases.
@@ -31,7 +61,12 @@ struct {
 void
 kinit1(void *vstart, void *vend)
 {
+  int i;
+
   initlock(&kmem.lock, "kmem");
+  for(i = 0; i < NCPU; i++)
+    initlock(&kmem.cache[i].lock, "kmem_cache");
+  initlock(&kmem.zlock, "kmem_zero");
   kmem.use_lock = 0;
   freerange(vstart, vend);
 }
@@ -51,6 +86,97 @@ freerange(void *vstart, void *vend)
   for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
     kfree(p);
 }
+// Move up to n pages from the global list to c.
+// Caller holds c->lock.
+static void
+refill(struct kmem_cache *c, int n)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  while(n-- > 0 && (r = kmem.freelist) != 0){
+    kmem.freelist = r->next;
+    r->next = c->freelist;
+    c->freelist = r;
+    c->nfree++;
+  }
+  release(&kmem.lock);
+}
+
+// Move n pages from c back to the global list.
+// Caller holds c->lock.
+static void
+spill(struct kmem_cache *c, int n)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  while(n-- > 0 && (r = c->freelist) != 0){
+    c->freelist = r->next;
+    c->nfree--;
+    r->next = kmem.freelist;
+    kmem.freelist = r;
+  }
+  release(&kmem.lock);
+}
+
+// The global list is empty too: take half of another CPU's cache.
+// Only one cache lock is held at a time, so two CPUs stealing from
+// each other cannot deadlock. Returns one page and keeps the rest
+// in cache me. Called with interrupts off.
+static struct run*
+steal(int me)
+{
+  struct kmem_cache *c;
+  struct run *r, *stolen;
+  int i, n;
+
+  stolen = 0;
+  for(i = 0; i < ncpu && stolen == 0; i++){
+    if(i == me)
+      continue;
+    c = &kmem.cache[i];
+    acquire(&c->lock);
+    for(n = (c->nfree + 1) / 2; n > 0; n--){
+      r = c->freelist;
+      c->freelist = r->next;
+      c->nfree--;
+      r->next = stolen;
+      stolen = r;
+    }
+    release(&c->lock);
+  }
+  if(stolen == 0)
+    return 0;
+
+  c = &kmem.cache[me];
+  acquire(&c->lock);
+  while((r = stolen->next) != 0){
+    stolen->next = r->next;
+    r->next = c->freelist;
+    c->freelist = r;
+    c->nfree++;
+  }
+  release(&c->lock);
+  return stolen;
+}
+
+// Take a page from the zero pool, or return 0 if it is empty.
+static struct run*
+zpop(void)
+{
+  struct run *r;
+
+  acquire(&kmem.zlock);
+  r = kmem.zeroed;
+  if(r){
+    kmem.zeroed = r->next;
+    kmem.nzero--;
+  }
+  release(&kmem.zlock);
+  return r;
+}
+
 //PAGEBREAK: 21
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
@@ -60,20 +186,39 @@ void
 kfree(char *v)
 {
   struct run *r;
+  struct kmem_cache *c;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+  // Drop a reference; the page is free once none are left. Pages
+  // freed by kinit1() and kinit2() have none to drop.
+  if(kmem.ref[V2P(v)/PGSIZE] != 0 &&
+     __sync_sub_and_fetch(&kmem.ref[V2P(v)/PGSIZE], 1) != 0)
+    return;
+
+#if KALLOC_JUNK
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+  if(!kmem.use_lock){
+    // Still in kinit1(); only this CPU is running.
+    r->next = kmem.freelist;
+    kmem.freelist = r;
+    return;
+  }
+
+  pushcli();  // Stay on this CPU
+  c = &kmem.cache[cpuid()];
+  acquire(&c->lock);
+  r->next = c->freelist;
+  c->freelist = r;
+  if(++c->nfree > KMEM_CACHE_MAX)
+    spill(c, KMEM_BATCH);
+  release(&c->lock);
+  popcli();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -83,14 +228,96 @@ char*
 kalloc(void)
 {
   struct run *r;
+  struct kmem_cache *c;
+  int id;
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
-  r = kmem.freelist;
+  if(!kmem.use_lock){
+    r = kmem.freelist;
+    if(r)
+      kmem.freelist = r->next;
+    return (char*)r;
+  }
+
+  pushcli();  // Stay on this CPU
+  id = cpuid();
+  c = &kmem.cache[id];
+  acquire(&c->lock);
+  if(c->freelist == 0)
+    refill(c, KMEM_BATCH);
+  r = c->freelist;
+  if(r){
+    c->freelist = r->next;
+    c->nfree--;
+  }
+  release(&c->lock);
+  if(r == 0)
+    r = steal(id);
+  popcli();
+  if(r == 0)
+    r = zpop();  // Last resort: pages set aside for kzalloc()
   if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+    kmem.ref[V2P(r)/PGSIZE] = 1;
   return (char*)r;
 }
 
+// Add a reference to an allocated page, which must then be
+// kfree()d once more before it is free.
+void
+kref(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+    panic("kref");
+  __sync_add_and_fetch(&kmem.ref[V2P(v)/PGSIZE], 1);
+}
+
+// Number of references to an allocated page.
+int
+krefcount(char *v)
+{
+  return kmem.ref[V2P(v)/PGSIZE];
+}
+
+// Allocate one zero-filled page. Takes a page zeroed in advance by
+// kzrefill() if there is one, so the caller skips the memset.
+char*
+kzalloc(void)
+{
+  struct run *r;
+  char *mem;
+
+  if(kmem.use_lock && (r = zpop()) != 0){
+    r->next = 0;  // The only word that is not zero
+    return (char*)r;
+  }
+  if((mem = kalloc()) != 0)
+    memset(mem, 0, PGSIZE);
+  return mem;
+}
+
+// Zero one free page into the pool used by kzalloc(), unless it is
+// full. Called by scheduler() when it finds nothing to run, so the
+// zeroing happens while the CPU would otherwise be idle.
+void
+kzrefill(void)
+{
+  char *mem;
+
+  // Unlocked peek, so an idle CPU with a full pool takes no lock;
+  // the count is checked again below.
+  if(!kmem.use_lock || kmem.nzero >= KMEM_ZERO_MAX)
+    return;
+  if((mem = kalloc()) == 0)
+    return;
+  memset(mem, 0, PGSIZE);
+  acquire(&kmem.zlock);
+  if(kmem.nzero < KMEM_ZERO_MAX){
+    ((struct run*)mem)->next = kmem.zeroed;
+    kmem.zeroed = (struct run*)mem;
+    kmem.nzero++;
+    mem = 0;
+  }
+  release(&kmem.zlock);
+  if(mem)
+    kfree(mem);
+}
+
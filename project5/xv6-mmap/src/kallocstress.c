@@ -0,0 +1,73 @@
+// Stress the physical page allocator from several CPUs at once.
+//
+//   kallocstress [nproc [npages [rounds]]]
+//
+// Forks nproc children (run with nproc equal to CPUS to keep every
+// CPU busy). Each maps npages anonymous pages, touches every page so
+// that pagefault_handler() kalloc()s it, unmaps them again so they
+// are kfree()d, and repeats that rounds times. Prints the total
+// number of page allocations and allocations per clock tick.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "mmu.h"
+#include "mman.h"
+
+void
+churn(int npages, int rounds)
+{
+  char *p;
+  int i, r;
+
+  for(r = 0; r < rounds; r++){
+    p = mmap(0, npages*PGSIZE, PROT_WRITE, MAP_ANONYMOUS, -1, 0);
+    if(p == 0 || p == (char*)-1){
+      printf(1, "kallocstress: mmap failed\n");
+      exit();
+    }
+    for(i = 0; i < npages; i++)
+      p[i*PGSIZE] = r;
+    if(munmap(p, npages*PGSIZE) < 0){
+      printf(1, "kallocstress: munmap failed\n");
+      exit();
+    }
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nproc, npages, rounds, i, start, ticks;
+
+  nproc = argc > 1 ? atoi(argv[1]) : 2;
+  npages = argc > 2 ? atoi(argv[2]) : 64;
+  rounds = argc > 3 ? atoi(argv[3]) : 200;
+  if(nproc < 1 || npages < 1 || rounds < 1){
+    printf(2, "usage: kallocstress [nproc [npages [rounds]]]\n");
+    exit();
+  }
+
+  printf(1, "kallocstress: %d processes, %d pages, %d rounds\n",
+         nproc, npages, rounds);
+  start = uptime();
+  for(i = 0; i < nproc; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf(1, "kallocstress: fork failed\n");
+      break;
+    }
+    if(pid == 0){
+      churn(npages, rounds);
+      exit();
+    }
+  }
+  nproc = i;
+  for(i = 0; i < nproc; i++)
+    wait();
+  ticks = uptime() - start;
+
+  printf(1, "kallocstress: %d allocations in %d ticks, %d per tick\n",
+         nproc*npages*rounds, ticks, nproc*npages*rounds / (ticks ? ticks : 1));
+  exit();
+}
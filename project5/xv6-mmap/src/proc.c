@@ -366,6 +366,7 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int ran;
   c->proc = 0;
   
   for(;;){
@@ -373,6 +374,7 @@ scheduler(void)
     sti();
 
     // Loop over process table looking for process to run.
+    ran = 0;
     acquire(&ptable.lock);
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
       if(p->state != RUNNABLE)
@@ -384,6 +386,7 @@ scheduler(void)
       c->proc = p;
       switchuvm(p);
       p->state = RUNNING;
+      ran = 1;
 
       swtch(&(c->scheduler), p->context);
       switchkvm();
@@ -394,6 +397,9 @@ scheduler(void)
     }
     release(&ptable.lock);
 
+    // Nothing to run: zero a page ahead for kzalloc().
+    if(!ran)
+      kzrefill();
   }
 }
 
@@ -75,6 +75,8 @@ sys_read(void)
 
   if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
     return -1;
+  if(cowrange(myproc()->pgdir, p, n) < 0)
+    return -1;
   return fileread(f, p, n);
 }
 
@@ -111,6 +113,8 @@ sys_fstat(void)
 
   if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
     return -1;
+  if(cowrange(myproc()->pgdir, (char*)st, sizeof(*st)) < 0)
+    return -1;
   return filestat(f, st);
 }
 
@@ -429,6 +433,8 @@ sys_pipe(void)
 
   if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
     return -1;
+  if(cowrange(myproc()->pgdir, (char*)fd, 2*sizeof(fd[0])) < 0)
+    return -1;
   if(pipealloc(&rf, &wf) < 0)
     return -1;
   fd0 = -1;
@@ -122,11 +122,13 @@ void pagefault_handler(struct trapframe *tf) {
   void *fault_addr = (void *) rcr2();
   void *fault_page = (void *) PGROUNDDOWN((uint)fault_addr);
 
+#ifdef DEBUG_PAGEFAULT
   cprintf("============in pagefault_handler============\n" \
           "pid %d %s: trap %d err %d on cpu %d " \
           "eip 0x%x addr 0x%x\n", \
           curproc->pid, curproc->name, tf->trapno, \
           tf->err, cpuid(), tf->eip, fault_addr);
+#endif
 
   /*
     31              15                             4               0
@@ -138,7 +140,21 @@ void pagefault_handler(struct trapframe *tf) {
     U	1 bit	: User	When set, the page fault was caused while CPL = 3. This does not necessarily mean that the page fault was a privilege violation.    
   */
   if ((tf->err & 0x1) != 0) {
-    /* Protection violation error. */
+    /* Protection violation error. A write to a page shared by a
+       copy-on-write fork is not one; the page is copied instead. */
+    if ((tf->err & 0x2) != 0 && cowuvm(curproc->pgdir, fault_page) == 0) {
+      return;
+    }
+    /* System calls copy the copy-on-write pages they write to first (see
+       cowrange), so one left over in the kernel is a kernel bug. Killing
+       the process would not help: the kernel resumes at the faulting
+       instruction and faults again, often with locks held. */
+    if ((tf->cs & 3) == 0) {
+      cprintf("pid %d %s: kernel protection fault err %d on cpu %d "
+              "eip 0x%x addr 0x%x\n", curproc->pid, curproc->name,
+              tf->err, cpuid(), tf->eip, fault_addr);
+      panic("pagefault: kernel protection fault");
+    }
     // cprintf("XV6_TEST_OUTPUT : try to write to nonwritable page\n");
     curproc->killed = 1;
     return;
@@ -165,14 +181,14 @@ void pagefault_handler(struct trapframe *tf) {
   }
 
   /* Valid region so try to create a mapping in physical memory */
-  char *mem = kalloc();
+  /* Usually a page zeroed ahead of time, so no memset here */
+  char *mem = kzalloc();
   if (mem == 0) {
     /* No more memory available */
     curproc->killed = 1;
     // cprintf("XV6_TEST_OUTPUT : no more memory\n");
     return;    
   }
-  memset(mem, 0, PGSIZE);
   if (mappages(curproc->pgdir, fault_page, PGSIZE, (uint) V2P(mem), curproc->mmap_regions->prot | PTE_U) < 0) {
     kfree(mem);
     curproc->killed = 1;
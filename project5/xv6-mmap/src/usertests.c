@@ -1695,6 +1695,105 @@ fsfull()
   printf(1, "fsfull test finished\n");
 }
 
+// a page shared by a copy-on-write fork is copied on the first
+// write, by the parent or the child, and the other never sees it.
+void
+cowtest(void)
+{
+  int pid, fds[2];
+  char *a, c;
+  int i;
+
+  printf(stdout, "cow test\n");
+  a = sbrk(8*4096);
+  for(i = 0; i < 8*4096; i += 4096)
+    a[i] = 'p';
+
+  if(pipe(fds) != 0){
+    printf(stdout, "pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    // The child writes every other page, then reads into one
+    // through the kernel, which faults on it in kernel mode.
+    for(i = 0; i < 8*4096; i += 2*4096)
+      a[i] = 'c';
+    read(fds[0], a + 4096, 1);
+    for(i = 0; i < 8*4096; i += 4096){
+      c = (i/4096) % 2 == 0 || i == 4096 ? 'c' : 'p';
+      if(a[i] != c){
+        printf(stdout, "cow test: child sees %c at page %d\n", a[i], i/4096);
+        exit();
+      }
+    }
+    exit();
+  }
+  write(fds[1], "c", 1);
+  a[3*4096] = 'q';
+  wait();
+  close(fds[0]);
+  close(fds[1]);
+  for(i = 0; i < 8*4096; i += 4096){
+    c = i == 3*4096 ? 'q' : 'p';
+    if(a[i] != c){
+      printf(stdout, "cow test: parent sees %c at page %d\n", a[i], i/4096);
+      exit();
+    }
+  }
+  sbrk(-8*4096);
+  printf(stdout, "cow test ok\n");
+}
+
+// time fork+exit and fork+exec+exit of a process with a 1 MB heap,
+// the pattern of a shell, where fork copies pages exec throws away.
+void
+forkexecbench(void)
+{
+  char *args[] = { "usertests", "-exit", 0 };
+  char *a;
+  int i, n, pid, start, forkticks, execticks;
+
+  printf(stdout, "fork+exec benchmark\n");
+  a = sbrk(1024*1024);
+  for(i = 0; i < 1024*1024; i += 4096)
+    a[i] = 1;
+
+  n = 200;
+  start = uptime();
+  for(i = 0; i < n; i++){
+    pid = fork();
+    if(pid < 0)
+      break;
+    if(pid == 0)
+      exit();
+    wait();
+  }
+  forkticks = uptime() - start;
+
+  start = uptime();
+  for(i = 0; i < n; i++){
+    pid = fork();
+    if(pid < 0)
+      break;
+    if(pid == 0){
+      exec("usertests", args);
+      printf(stdout, "exec usertests failed\n");
+      exit();
+    }
+    wait();
+  }
+  execticks = uptime() - start;
+
+  sbrk(-1024*1024);
+  printf(stdout, "fork+exec benchmark: %d fork in %d ticks, %d fork+exec in %d ticks\n",
+         n, forkticks, n, execticks);
+}
+
 void
 uio()
 {
@@ -1748,6 +1847,10 @@ rand()
 int
 main(int argc, char *argv[])
 {
+  // forkexecbench() execs this program just to have it exit.
+  if(argc > 1 && strcmp(argv[1], "-exit") == 0)
+    exit();
+
   printf(1, "usertests starting\n");
 
   if(open("usertests.ran", 0) >= 0){
@@ -1793,6 +1896,8 @@ main(int argc, char *argv[])
   dirfile();
   iref();
   forktest();
+  cowtest();
+  forkexecbench();
   bigdir(); // slow
 
   uio();
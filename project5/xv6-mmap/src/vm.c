@@ -42,10 +42,9 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
+    // Zero-filled, so all those PTE_P bits are zero.
+    if(!alloc || (pgtab = (pte_t*)kzalloc()) == 0)
       return 0;
-    // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -336,7 +335,6 @@ copyuvm(pde_t *pgdir, uint sz)
   pde_t *d;
   pte_t *pte;
   uint pa, i, flags;
-  char *mem;
 
   if((d = setupkvm()) == 0)
     return 0;
@@ -345,23 +343,82 @@ copyuvm(pde_t *pgdir, uint sz)
       panic("copyuvm: pte should exist");
     if(!(*pte & PTE_P))
       panic("copyuvm: page not present");
+    // Share the page, read-only in both processes. The first
+    // write to it by either one makes a private copy; see cowuvm().
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
-      kfree(mem);
+    if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0)
       goto bad;
-    }
+    kref(P2V(pa));
   }
+  // The parent's writable TLB entries are stale now.
+  lcr3(V2P(pgdir));
   return d;
 
 bad:
+  lcr3(V2P(pgdir));
   freevm(d);
   return 0;
 }
 
+// Handle a write fault at va in the current process's pgdir.
+// If the page is copy-on-write, give the process a writable copy
+// of its own, or just make it writable if no one else shares it
+// any more. Returns -1 if the page is not copy-on-write or there
+// is no memory for the copy.
+int
+cowuvm(pde_t *pgdir, char *va)
+{
+  pte_t *pte;
+  uint pa, flags;
+  char *mem;
+
+  pte = walkpgdir(pgdir, va, 0);
+  if(pte == 0 || (*pte & (PTE_P|PTE_COW)) != (PTE_P|PTE_COW))
+    return -1;
+  pa = PTE_ADDR(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+  if(krefcount(P2V(pa)) == 1){
+    *pte = pa | flags;
+  } else {
+    if((mem = kalloc()) == 0)
+      return -1;
+    memmove(mem, (char*)P2V(pa), PGSIZE);
+    *pte = V2P(mem) | flags;
+    kfree(P2V(pa));
+  }
+  lcr3(V2P(pgdir));
+  return 0;
+}
+
+// Give the process private copies of the copy-on-write pages in
+// [va, va+len) before the kernel writes there, so that the write
+// cannot fault with no memory for the copy. Returns -1 if there
+// is no memory for a copy.
+int
+cowrange(pde_t *pgdir, char *va, uint len)
+{
+  char *a, *last;
+  pte_t *pte;
+
+  if(len == 0)
+    return 0;
+  a = (char*)PGROUNDDOWN((uint)va);
+  last = (char*)PGROUNDDOWN((uint)va + len - 1);
+  for(;;){
+    pte = walkpgdir(pgdir, a, 0);
+    if(pte != 0 && (*pte & (PTE_P|PTE_COW)) == (PTE_P|PTE_COW) &&
+       cowuvm(pgdir, a) < 0)
+      return -1;
+    if(a == last)
+      break;
+    a += PGSIZE;
+  }
+  return 0;
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*